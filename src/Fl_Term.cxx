@@ -43,13 +43,26 @@ char *host_cb1(void *data, const char *prompt, bool echo)
 	Fl_Term *term = (Fl_Term *)data;
 	return term->gets(prompt, echo);
 }
-int Fl_Term::connect(HOST *newhost, const char **preply )
+
+//static init runs on the main thread, which holds the FLTK lock
+//except while FLTK waits for events
+static std::thread::id gui_thread = std::this_thread::get_id();
+void Fl_Term::host_stop(bool drain)
+{//the parser may be waiting for the lock in append(), never join holding it
+	bool gui = std::this_thread::get_id()==gui_thread;
+	if ( gui ) Fl::unlock();
+	host->stop(drain);
+	if ( gui ) Fl::lock();
+}
+int Fl_Term::connect(HOST *newhost, const char **preply, Fl_Term_Pin *out)
 {
 	int rc = 0;
-	if ( host->live() ) return rc;
+	if ( host->live() || replay_map!=NULL ) return rc;
+	host_stop(true);	//output of the old host still goes to this term
 	delete host;
 
 	host = newhost;
+	stats_reset();
 	strncpy(sTitle, host->name(), 40);
 	sTitle[40]=0;
 	copy_label(sTitle);
@@ -59,8 +72,8 @@ int Fl_Term::connect(HOST *newhost, const char **preply )
 	mark_prompt();
 	host->connect();
 	if ( preply!=NULL ) {	//waitfor prompt if called from script
-		*preply = buff+recv0;	//no wait if called from edit line
-		rc = waitfor_prompt();
+		rc = waitfor_prompt();	//no wait if called from edit line
+		*preply = reply(recv0, rc, out);
 	}
 	return rc;
 }
@@ -72,10 +85,21 @@ void Fl_Term::puts( const char *buf, int len )	//parse text received from host
 	}
 	else
 		if ( len>0 ) {//data from host, display
+			flow_bytes += len;
+			stat_bytes += len;
+			unsigned queued = host->queued();
+			if ( stat_queue_max<queued ) stat_queue_max = queued;
+			if ( throttle_rate>0 ) govern(len);
+			std::chrono::steady_clock::time_point t0 =
+										std::chrono::steady_clock::now();
 			if ( host->type()==HOST_CONF )
 				put_xml(buf, len);
 			else
 				append(buf, len);
+			long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>
+								(std::chrono::steady_clock::now()-t0).count();
+			stat_parse_ns += ns;
+			if ( stat_parse_max<ns ) stat_parse_max = ns;
 		}
 		else {//len<0 Disconnected, or failure
 			if ( *buf ) {
@@ -90,12 +114,18 @@ void Fl_Term::puts( const char *buf, int len )	//parse text received from host
 }
 void Fl_Term::write(const char *buf, int len) //send text to host
 { 
+	if ( replay_map!=NULL ) {	//read-only, keys move through the log
+		if ( len==1 && *buf==0x1b ) disconn();	//Escape ends it
+		else replay_keys(buf, len);
+		return;
+	}
 	if ( host->live() ) {
 		if ( !bGets ) {
 			if ( bEcho ) append(buf, len);
 			host->write(buf, len);
 			return;
 		}
+		std::unique_lock<std::mutex> lck(gets_mtx);
 		for ( int i=0; i<len&&bGets; i++ ) {
 			switch(buf[i]) {
 				case '\177':
@@ -117,6 +147,8 @@ void Fl_Term::write(const char *buf, int len) //send text to host
 					if ( !bPassword ) append(buf+i, 1);
 			}
 		}
+		lck.unlock();
+		gets_cv.notify_all();
 	}
 	else {
 		if ( *buf=='\r' ) host->connect();
@@ -130,87 +162,121 @@ char *Fl_Term::gets(const char *prompt, int echo)	//get user input for host
 	bReturn = false;
 	bPassword = !echo;
 	int old_cursor = cursor;
-	for ( int i=0; i<600&&bGets&&(!bReturn); i++ ) {
-		if ( cursor>old_cursor ) { 
-			old_cursor=cursor;
-			i=0;
-		}
-		Sleep(100);
+	std::unique_lock<std::mutex> lck(gets_mtx);
+	while ( bGets && !bReturn ) {	//woken by write(), 60 seconds idle time out
+		if ( !gets_cv.wait_for(lck, std::chrono::seconds(60), [this, old_cursor]
+				{ return !bGets || bReturn || cursor!=old_cursor; }) ) break;
+		old_cursor = cursor;
 	}
 	bGets = false;
 	return bReturn?keys:NULL;
 }
 void Fl_Term::disconn()
 {
-	bGets = false;
+	{
+		std::lock_guard<std::mutex> lck(gets_mtx);
+		bGets = false;
+	}
+	gets_cv.notify_all();
 	host->disconn();
+	if ( replay_map!=NULL ) {	//a replay ends like a session
+		replay_end();
+		*sTitle = 0;
+		do_callback(this, (void *)NULL);
+	}
 }
 
-Fl_Term::Fl_Term(int X,int Y,int W,int H,const char *L) : Fl_Widget(X,Y,W,H,L)
+Fl_Term::Fl_Term(int X,int Y,int W,int H,const char *L) :
+	Fl_Widget(X,Y,W,H,L), Fl_Term_Core(80, 25)
 {
-	bEcho = false;
 	bScrollbar = false;
+	bStats = false;
+	changed_ns = 0;
 	host = new HOST();
+	stats_reset();
 
-	*sTitle = 0;
-	strcpy(sPrompt, "> ");
-	iPrompt = 2;
 	iTimeOut = 30;
 	bDND = false;
 	bScriptRun = bScriptPause = false;
-	fpLogFile = NULL;
-	LogFileName = NULL;
-
-	line = NULL;
-	buff = attr = NULL;
-	clear();
+	reply_buf = NULL;
+	row_drawn = NULL;
+	drawn_rows = drawn_y = 0;
+	drawn_cx = drawn_cy = drawn_sel_l = drawn_sel_r = 0;
+	drawn_cursor = false;
+	drawn_bar = false;
+	wide_width = NULL;
+	srch_cancel = srch_new = false;
+	srch_found = NULL;
+	srch_found_cnt = srch_found_room = 0;
+	save_pct = -1;
+	replay_map = NULL;
+	replay_size = replay_pos = replay_goal = 0;
+	replay_num = 0;
+	replay_stop = false;
+	marks = NULL;
+	mark_cnt = mark_room = 0;
+	flow_bytes = 0;
+	flooded = false;
+	throttle_rate = 0;
+	throttle_credit = 0;
 
 	textfont(FL_COURIER);
 	textsize(16);
 	size_x = w()/font_width;
 	size_y = h()/font_height;
+	clear();
 	roll_top = 0;
 	roll_bot = size_y-1;
 	color(FL_BLACK);
 }
 Fl_Term::~Fl_Term()
 {
+	replay_end();
+	free(marks);
+	host_stop(false);
 	delete host;
-	free(attr);
-	free(buff);
-	free(line);
+	free(reply_buf);
+	free(row_drawn);
+	srch_stop();
+	if ( saver.joinable() ) saver.join();
+	free(srch_found);
+	for ( int i=0; i<0x1100 && wide_width!=NULL; i++ )
+		free(wide_width[i]);
+	free(wide_width);
 };
 void Fl_Term::clear()
 {
-	Fl::lock();
-	line_size = 4096;
-	buff_size = 4096*64;
-	buff = (char *)realloc(buff, buff_size);
-	attr = (char *)realloc(attr, buff_size);
-	line = (int * )realloc(line, line_size*sizeof(int));
-	if ( line!=NULL ) memset(line, 0, line_size*sizeof(int) );
-	if ( buff!=NULL ) memset(buff, 0, buff_size);
-	if ( attr!=NULL ) memset(attr, 0, buff_size);
-	cursor_y = cursor_x = 0;
-	screen_y = 0;
-	sel_left = sel_right= 0;
-	c_attr = 7;//default black background, white foreground
-	recv0 = 0;
-	ESC_idx = 0;
-	bInsert = bEscape = bGraphic = bTitle = false;
-	bBracket = bAltScreen = bAppCursor = bOriginMode = false;
-	bWraparound = true;
+	srch_stop();
+	Fl_Term_Core::clear();
 	bScrollbar = false;
-	bCursor = true;
-	bPrompt = true;
-	memset(tabstops, 0, 256);
-	for ( int i=0; i<256; i+=8 ) tabstops[i]=1;
-
-	xmlIndent=0;
-	xmlTagIsOpen=true;
-	redraw_pending=true;
+}
+//draw() and handle() run with the FLTK lock held, so the core takes it too
+void Fl_Term::lock()
+{
+	Fl::lock();
+}
+void Fl_Term::unlock()
+{
 	Fl::unlock();
 }
+void Fl_Term::bell()
+{
+	fl_beep(FL_BEEP_DEFAULT);
+}
+void Fl_Term::notify()
+{
+	do_callback(this, (void *)sTitle);
+}
+void Fl_Term::answer(const char *buf, int len)
+{
+	host->write(buf, len);
+}
+void Fl_Term::wake()
+{
+	changed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	Fl::awake();
+}
 void Fl_Term::resize(int X, int Y, int W, int H)
 {
 	Fl_Widget::resize(X,Y,W,H);
@@ -220,22 +286,85 @@ void Fl_Term::resize(int X, int Y, int W, int H)
 	roll_bot = size_y-1;
 	if ( screen_y< cursor_y-size_y+1 )
 		screen_y = cursor_y-size_y+1;
+	append_mtx.lock();		//the FLTK lock is held already
+	more_room();
+	reclaim();
+	append_mtx.unlock();
 	host->send_size(size_x, size_y);
 	redraw();
 }
 void Fl_Term::textfont(Fl_Font fontface)
 {
 	font_face = fontface;
-	fl_font(font_face, font_size);
-	font_width = fl_width("abcdefghij")/10;
-	font_height = fl_height();
+	font_metrics();
 }
 void Fl_Term::textsize(int fontsize)
 {
 	font_size = fontsize;
+	font_metrics();
+}
+void Fl_Term::font_metrics()
+{//ASCII widths are measured now, others when first drawn
 	fl_font(font_face, font_size);
 	font_width = fl_width("abcdefghij")/10;
 	font_height = fl_height();
+	for ( int i=0; i<128; i++ ) {
+		char c = i;
+		ascii_width[i] = fl_width(&c, 1);
+	}
+	if ( wide_width!=NULL ) for ( int i=0; i<0x1100; i++ ) {
+		free(wide_width[i]);
+		wide_width[i] = NULL;
+	}
+}
+float Fl_Term::glyph_width(const char *p, const char *e, int *len)
+{//width of the UTF-8 character at p, and its length in bytes
+	if ( (unsigned char)*p<0x80 ) {
+		*len = 1;
+		return ascii_width[(int)*p];
+	}
+	unsigned int u = fl_utf8decode(p, e, len);
+	if ( u>=0x110000 ) u = 0xfffd;
+	if ( wide_width==NULL ) {
+		wide_width = (float **)calloc(0x1100, sizeof(float *));
+		if ( wide_width==NULL ) return fl_width(u);
+	}
+	float *&page = wide_width[u>>8];	//256 characters per page
+	if ( page==NULL ) {
+		page = (float *)malloc(256*sizeof(float));
+		if ( page==NULL ) return fl_width(u);
+		for ( int i=0; i<256; i++ ) page[i] = -1;
+	}
+	if ( page[u&0xff]<0 ) {
+		fl_font(font_face, font_size);
+		page[u&0xff] = fl_width(u);
+	}
+	return page[u&0xff];
+}
+float Fl_Term::text_width(const char *p, int n)
+{
+	const char *e = p+n;
+	float w = 0;
+	while ( p<e ) {
+		int l;
+		w += glyph_width(p, e, &l);
+		p += l>0 ? l : 1;
+	}
+	return w;
+}
+int Fl_Term::row_pos(int y, int px)
+{//position of the character at pixel px on line y, for mouse selection
+	int a = line[y], z = line[y+1];
+	float w = 0;
+	while ( a<z ) {
+		char c[4];
+		int n = z-a<4 ? z-a : 4, l;
+		buff.get(c, a, n);
+		w += glyph_width(c, c+n, &l);
+		if ( w>px ) break;
+		a += l>0 ? l : 1;
+	}
+	return a<z ? a : z;
 }
 const unsigned int VT_attr[] = {
 	0x00000000, 0xc0000000, 0x00c00000, 0xc0c00000,	//0,1,2,3
@@ -243,38 +372,225 @@ const unsigned int VT_attr[] = {
 	FL_BLACK, FL_RED, FL_GREEN, FL_YELLOW,
 	FL_BLUE, FL_MAGENTA, FL_CYAN, FL_WHITE
 };
+void Fl_Term::scroll_cb(void *data, int X, int Y, int W, int H)
+{//area fl_scroll() couldn't copy, clear it and draw the rows there again
+	Fl_Term *term = (Fl_Term *)data;
+	fl_color(term->color());
+	fl_rectf(X, Y, W, H);
+	for ( int i=0; i<term->drawn_rows; i++ ) {
+		int top = term->y()+i*term->font_height+4;
+		if ( top<Y+H && top+term->font_height>Y ) term->row_drawn[i] = 0;
+	}
+}
+double Fl_Term::since_drawn()
+{//seconds since last draw(), to keep repaints a frame apart
+	std::chrono::duration<double> d = std::chrono::steady_clock::now()-drawn_at;
+	return d.count();
+}
+double Fl_Term::frame_wait()
+{//seconds until next repaint is due, frames are skipped while flooded
+	return (flooded ? TERM_FLOOD_FRAME : TERM_FRAME) - since_drawn();
+}
+void Fl_Term::stats_reset()
+{
+	stat_at = std::chrono::steady_clock::now();
+	stat_bytes = stat_parse_ns = stat_parse_max = 0;
+	stat_queue_max = 0;
+	stat_draw_ns = stat_draw_max = stat_lag_max = 0;
+	stat_draws = stat_dropped = 0;
+}
+int Fl_Term::stats_text(char *buf, int size)
+{//TERM_STATS_ROWS lines, for the overlay and for !Stats
+	std::chrono::duration<double> d = std::chrono::steady_clock::now()-stat_at;
+	double secs = d.count();
+	long long bytes = stat_bytes;
+	int draws = stat_draws;
+	return snprintf(buf, size, "recv %lld bytes %.1f KB/s\n"
+					"parse %.1f ns/byte %.3f ms max\n"
+					"draw %d frames %.3f ms avg %.3f ms max\n"
+					"drop %d frames %.1f ms lag max\n"
+					"queue %u bytes %u max\n",
+					bytes, secs>0 ? bytes/secs/1024 : 0,
+					bytes>0 ? (double)stat_parse_ns/bytes : 0,
+					stat_parse_max/1e6,
+					draws, draws>0 ? stat_draw_ns/1e6/draws : 0,
+					stat_draw_max/1e6, stat_dropped, stat_lag_max/1e6,
+					host->queued(), (unsigned)stat_queue_max);
+}
+void Fl_Term::stats_overlay(bool on)
+{//may be called from the scripting thread
+	lock();
+	bStats = on;
+	redraw();
+	unlock();
+	Fl::awake();
+}
+void Fl_Term::stats_draw()
+{//top right corner, over the rows draw() repaints every time for it
+	char text[512];
+	stats_text(text, sizeof(text));
+	int wi = 0;
+	for ( char *p=text, *q; (q=strchr(p, '\n'))!=NULL; p=q+1 ) {
+		int l = text_width(p, q-p);
+		if ( wi<l ) wi = l;
+	}
+	int dx = x()+w()-wi-16;
+	fl_color(FL_DARK3);
+	fl_rectf(dx, y()+4, wi+8, TERM_STATS_ROWS*font_height);
+	fl_color(FL_YELLOW);
+	int dy = y();
+	for ( char *p=text, *q; (q=strchr(p, '\n'))!=NULL; p=q+1 ) {
+		dy += font_height;
+		fl_draw(p, q-p, dx+4, dy);
+	}
+}
+void Fl_Term::govern(int len)
+{//parser sleeps to keep throttle_rate, the HOST ring then fills up and
+ //the reader stops reading, which closes the tcp or ssh channel window
+	std::chrono::steady_clock::time_point now=std::chrono::steady_clock::now();
+	std::chrono::duration<double> dt = now-throttle_at;
+	throttle_at = now;
+	throttle_credit += dt.count()*throttle_rate;
+	if ( throttle_credit>throttle_rate*TERM_FLOOD_FRAME )
+		throttle_credit = throttle_rate*TERM_FLOOD_FRAME;	//limit bursts
+	throttle_credit -= len;
+	if ( throttle_credit<0 ) {
+		std::chrono::duration<double> wait(-throttle_credit/throttle_rate);
+		std::this_thread::sleep_for(wait);
+	}
+}
 void Fl_Term::draw()
 {	
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	long long changed = changed_ns.exchange(0);
 	pending(false);
-	fl_color(color());
-	fl_rectf(x(),y(),w(),h());
+	if ( changed>0 ) {	//from the first change drawn to now
+		long long lag = std::chrono::duration_cast<std::chrono::nanoseconds>(
+									t0.time_since_epoch()).count()-changed;
+		if ( stat_lag_max<lag ) stat_lag_max = lag;
+		int frames = lag/(long long)(TERM_FRAME*1e9);
+		if ( frames>1 ) stat_dropped += frames-1;
+	}
+	int hit_lo = 0, hit_hi = 0;	//span of matches new to draw, if any
+	if ( srch_new ) {
+		int old = hit_cnt;
+		hit_merge();
+		if ( hit_cnt>old ) {
+			hit_lo = hits[old*2];
+			hit_hi = hits[hit_cnt*2-1];
+		}
+	}
+	flooded = flow_bytes.exchange(0)>TERM_FLOOD_RATE*since_drawn();
+	drawn_at = t0;
 	fl_font(font_face, font_size);
 
 	int sel_l=sel_left, sel_r=sel_right;
 	if ( sel_l>sel_r ) {
 		sel_l=sel_right; sel_r=sel_left;
 	}
+	int sel_a = sel_l<drawn_sel_l ? sel_l : drawn_sel_l;	//selection changed
+	int sel_b = sel_l<drawn_sel_l ? drawn_sel_l : sel_l;	//in [sel_a, sel_b)
+	int sel_c = sel_r<drawn_sel_r ? sel_r : drawn_sel_r;	//and [sel_c, sel_d)
+	int sel_d = sel_r<drawn_sel_r ? drawn_sel_r : sel_r;
+	drawn_sel_l = sel_l;
+	drawn_sel_r = sel_r;
+	bool cursor_moved = cursor_x!=drawn_cx || cursor_y!=drawn_cy ||
+						bCursor!=drawn_cursor;
+	int old_cy = drawn_cy;
+	drawn_cx = cursor_x;
+	drawn_cy = cursor_y;
+	drawn_cursor = bCursor;
 
+	//FL_DAMAGE_USER1 alone is new text, only rows the core marked dirty, or
+	//where the cursor, selection or matches changed are drawn, after the
+	//pixels of rows still on screen are moved along with screen_y
+	bool all = (damage()&~FL_DAMAGE_USER1)!=0 || bScrollbar || drawn_bar;
+	drawn_bar = bScrollbar;
+	if ( drawn_rows!=size_y ) {
+		char *p = (char *)realloc(row_drawn, size_y);
+		if ( p==NULL ) return;
+		row_drawn = p;
+		drawn_rows = size_y;
+		all = true;
+	}
+	int d = screen_y-drawn_y;
+	drawn_y = screen_y;
+	if ( bStats && d!=0 ) all = true;	//the overlay would scroll along
+	if ( all || d<=-size_y || d>=size_y ) {
+		for ( int i=0; i<size_y; i++ ) row_drawn[i] = 0;
+	}
+	else if ( d!=0 ) {
+		if ( d>0 ) for ( int i=0; i<size_y; i++ )
+			row_drawn[i] = i+d<size_y ? row_drawn[i+d] : 0;
+		else for ( int i=size_y-1; i>=0; i-- )
+			row_drawn[i] = i+d>=0 ? row_drawn[i+d] : 0;
+		fl_scroll(x(), y()+4, w(), size_y*font_height, 0, -d*font_height,
+					scroll_cb, this);
+	}
+	if ( bStats ) for ( int i=0; i<TERM_STATS_ROWS && i<size_y; i++ )
+		row_drawn[i] = 0;			//rows under the overlay
+	if ( all ) {
+		fl_color(color());
+		fl_rectf(x(),y(),w(),h());
+	}
+
+	static char text[TERM_LINE_ROOM];
 	int ly = screen_y;
+	thaw(line[ly], line[ly+size_y]-line[ly]);
 	int dx, dy=y();
+	bool cursor_drawn = all;
 	for ( int i=0; i<size_y; i++ ) {
 		dx = x()+1;
 		dy += font_height;
-		int j = line[ly+i];
-		while( j<line[ly+i+1] ) {
-			int n=j;
-			while (  attr[n]==attr[j] ) {
-				if ( ++n==line[ly+i+1]) break;
-				if ( n==sel_r || n==sel_l ) break;
-			}
-			unsigned int font_color = VT_attr[(int)attr[j]&0x0f];
-			unsigned int bg_color = VT_attr[(int)((attr[j]>>4)&0x0f)];
-			int wi = fl_width(buff+j, n-j);
+		bool redo = dirty(ly+i);	//taken before the row is read
+		int a = line[ly+i];			//copy the line out of the chunks,
+		int z = line[ly+i+1];		//it may span the end of a chunk
+		if ( z-a>TERM_LINE_ROOM ) z = a+TERM_LINE_ROOM;
+		if ( z<a ) z = a;
+		if ( !row_drawn[i] ) redo = true;
+		if ( cursor_moved && (ly+i==cursor_y || ly+i==old_cy) ) redo = true;
+		if ( (sel_a<z && sel_b>a) || (sel_c<z && sel_d>a) ) redo = true;
+		if ( hit_lo<z && hit_hi>a ) redo = true;
+		if ( !redo ) continue;
+		row_drawn[i] = 1;
+		if ( ly+i==cursor_y ) cursor_drawn = true;
+		buff.get(text, a, z-a);
+		char *t = text-a;			//so t[j] indexes like buff[j]
+		int lo = 0, hi = hit_cnt;	//first match ending after a
+		while ( lo<hi ) {
+			int mid = (lo+hi)/2;
+			if ( hits[mid*2+1]<=a ) lo = mid+1;
+			else hi = mid;
+		}
+		if ( !all ) {
+			fl_color(color());
+			fl_rectf(x(), dy-font_height+4, w(), font_height);
+		}
+
+		int j = a, k = -1, h = lo;
+		while( j<z ) {
+			char c;					//draw a run of the same attribute,
+			int n = attr.run(k, j, c);	//split at selection and match
+			if ( n>z ) n = z;		//boundaries
+			if ( j<sel_l && n>sel_l ) n = sel_l;
+			if ( j<sel_r && n>sel_r ) n = sel_r;
+			while ( h<hit_cnt && hits[h*2+1]<=j ) h++;
+			bool hit = h<hit_cnt && hits[h*2]<=j;
+			if ( h<hit_cnt && !hit && n>hits[h*2] ) n = hits[h*2];
+			if ( hit && n>hits[h*2+1] ) n = hits[h*2+1];
+			unsigned int font_color = VT_attr[(int)c&0x0f];
+			unsigned int bg_color = VT_attr[(int)((c>>4)&0x0f)];
+			int wi = text_width(t+j, n-j);
 			if ( j>=sel_l && j<sel_r ) {
 				fl_color(selection_color());
 				fl_rectf(dx, dy-font_height+4, wi, font_height);
 				fl_color(fl_contrast(font_color, selection_color()));
 			}
+			else if ( hit ) {
+				fl_color(FL_YELLOW);
+				fl_rectf(dx, dy-font_height+4, wi, font_height);
+				fl_color(FL_BLACK);
+			}
 			else {
 				if ( bg_color!=color() ) {
 					fl_color( bg_color );
@@ -282,20 +598,24 @@ void Fl_Term::draw()
 				}
 				fl_color( font_color );
 			}
-			int m = (buff[n-1]==0x0a) ? n-1 : n;	//don't draw LF, 
+			int m = (t[n-1]==0x0a) ? n-1 : n;	//don't draw LF,
 			//which will result in little squares on some platforms
-			fl_draw( buff+j, m-j, dx, dy );
+			fl_draw( t+j, m-j, dx, dy );
 			dx += wi;
 			j=n;
 		}
 	}
-	dx = x()+fl_width(buff+line[cursor_y], cursor_x-line[cursor_y]);
+	int cx = cursor_x-line[cursor_y];
+	if ( cx<0 ) cx = 0;
+	if ( cx>TERM_LINE_ROOM ) cx = TERM_LINE_ROOM;
+	buff.get(text, line[cursor_y], cx);
+	dx = x()+text_width(text, cx);
 	dy = y()+(cursor_y-screen_y)*font_height;
 	bool editor = bCursor;
 	if ( bAltScreen) editor=false;
 	if ( host->status()==HOST_AUTHENTICATING ) editor=false;
 	if ( !show_editor(editor?dx:-1, dy+4, w()-dx-8, font_height) ) {
-		if ( bCursor ) {
+		if ( bCursor && cursor_drawn ) {
 			fl_color(FL_WHITE);		//draw a white bar as cursor
 			fl_rectf(dx, dy+font_height, font_width, 4);
 		}
@@ -305,23 +625,39 @@ void Fl_Term::draw()
 		fl_color(FL_DARK3);			//draw scrollbar
 		fl_rectf(x()+w()-8, y(), 8, y()+h());
 		fl_color(FL_RED);			//draw slider
-		int slider_y = h()*screen_y/cursor_y;
+		int lines = cursor_y-line_first;
+		int slider_y = lines>0 ? h()*(screen_y-line_first)/lines : 0;
 		fl_rectf(x()+w()-8, y()+slider_y-8, 8, 16);
 	}
+	if ( bStats ) stats_draw();
+
+	long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+							std::chrono::steady_clock::now()-t0).count();
+	stat_draw_ns += ns;
+	if ( stat_draw_max<ns ) stat_draw_max = ns;
+	stat_draws++;
 }
 int Fl_Term::handle(int e)
 {
 	switch (e) {
 		case FL_LEAVE: 	//copy only when mouse leaves the term
-			if ( sel_left<sel_right )
-				Fl::copy(buff+sel_left, sel_right-sel_left, 1);
+			if ( sel_left<sel_right ) {
+				int len = sel_right-sel_left;
+				char *sel = (char *)malloc(len);
+				if ( sel!=NULL ) {
+					thaw(sel_left, len);
+					buff.get(sel, sel_left, len);
+					Fl::copy(sel, len, 1);
+					free(sel);
+				}
+			}
 			//fall through
 		case FL_ENTER: return 1;
 		case FL_FOCUS: redraw(); return 1;
 		case FL_MOUSEWHEEL:
 			if ( !bAltScreen ) {
 				screen_y += Fl::event_dy();
-				if ( screen_y<0 ) screen_y = 0;
+				if ( screen_y<line_first ) screen_y = line_first;
 				if ( screen_y>cursor_y ) screen_y = cursor_y;
 				bScrollbar = (screen_y < cursor_y-size_y+1);
 				redraw();
@@ -329,11 +665,12 @@ int Fl_Term::handle(int e)
 			return 1;
 		case FL_PUSH:
 			if ( Fl::event_button()==FL_LEFT_MOUSE ) {
-				int x=Fl::event_x()/font_width;
+				int px=Fl::event_x()-Fl_Widget::x()-1;
+				int x=px/font_width;
 				int y=Fl::event_y()-Fl_Widget::y();
 				if ( Fl::event_clicks()==1 ) {	//double click to select word
 					y = y/font_height + screen_y;
-					sel_left = line[y]+x;
+					sel_left = row_pos(y, px);
 					sel_right = sel_left;
 					while ( --sel_left>line[y] )
 						if ( buff[sel_left]==0x0a || buff[sel_left]==0x20 ) {
@@ -348,15 +685,14 @@ int Fl_Term::handle(int e)
 					return 1;
 				}
 				if ( x>=size_x-2 && bScrollbar) {//push in scrollbar area
-					if ( y>0 && y<h() ) screen_y = y*cursor_y/h();
+					if ( y>0 && y<h() )
+						screen_y = line_first+y*(cursor_y-line_first)/h();
 					bDragSelect = false;
 					redraw();
 				}
 				else {								//push to start draging
 					y = y/font_height + screen_y;
-					sel_left = line[y]+x;
-					if ( sel_left>line[y+1] ) sel_left=line[y+1] ;
-					while ( (buff[sel_left]&0xc0)==0x80 ) sel_left--;
+					sel_left = row_pos(y, px);
 					sel_right = sel_left;
 					bDragSelect = true;
 				}
@@ -364,27 +700,25 @@ int Fl_Term::handle(int e)
 			return 1;
 		case FL_DRAG:
 			if ( Fl::event_button()==FL_LEFT_MOUSE ) {
-				int x = Fl::event_x()/font_width;
+				int px = Fl::event_x()-Fl_Widget::x()-1;
 				int y = Fl::event_y()-Fl_Widget::y();
 				if ( !bDragSelect && y>0 && y<h()) {
-					screen_y = y*cursor_y/h();
+					screen_y = line_first+y*(cursor_y-line_first)/h();
 				}
 				else {
 					if ( y<0 ) {
 						screen_y += y/8;
-						if ( screen_y<0 ) screen_y = 0;
+						if ( screen_y<line_first ) screen_y = line_first;
 					}
 					if ( y>h() ) {
 						screen_y += (y-h())/8;
 						if ( screen_y>cursor_y ) screen_y=cursor_y;
 					}
 					y = y/font_height + screen_y;
-					if ( y<0 ) y=0;
+					if ( y<line_first ) y=line_first;
 					if ( !bAltScreen && y>cursor_y ) y = cursor_y;
 					//cursor_y may not be the last line in AlterScreen mode
-					sel_right = line[y]+x;
-					if ( sel_right>line[y+1] ) sel_right=line[y+1];
-					while ( (buff[sel_right]&0xc0)==0x80 ) sel_right++;
+					sel_right = row_pos(y, px);
 				}
 				redraw();
 			}
@@ -398,8 +732,16 @@ int Fl_Term::handle(int e)
 				if ( sel_left==sel_right ) redraw();//clear selection
 				break;
 			case FL_RIGHT_MOUSE:			//middle click to paste
-				if ( sel_left<sel_right ) 	//from selection
-					write(buff+sel_left, sel_right-sel_left);
+				if ( sel_left<sel_right ) {	//from selection
+					int len = sel_right-sel_left;
+					char *sel = (char *)malloc(len);
+					if ( sel!=NULL ) {
+						thaw(sel_left, len);
+						buff.get(sel, sel_left, len);
+						write(sel, len);
+						free(sel);
+					}
+				}
 				else 						//or from clipboard
 					Fl::paste(*this, 1);
 				break;
@@ -438,7 +780,7 @@ int Fl_Term::handle(int e)
 				if ( !bAltScreen ) {
 					bScrollbar = true;
 					screen_y -= size_y-1;
-					if ( screen_y<0 ) screen_y = 0;
+					if ( screen_y<line_first ) screen_y = line_first;
 					redraw();
 				}
 				break;
@@ -466,666 +808,583 @@ int Fl_Term::handle(int e)
 	}
 	return Fl_Widget::handle(e);
 }
-void Fl_Term::next_line()
+enum { TERM_SAVE_TEXT, TERM_SAVE_ANSI, TERM_SAVE_HTML };
+void Fl_Term::save(const char *fn)
+{//format by extension, .ans keeps colors as escapes, .htm/.html as spans
+	if ( save_pct>=0 ) {
+		disp("\r\n\033[31m***still saving, try again later***\033[37m\r\n");
+		return;
+	}
+	if ( saver.joinable() ) saver.join();
+	FILE *fp = fl_fopen(fn, "wb");
+	if ( fp==NULL ) {
+		disp("\r\n\033[31m***Failed to open ");
+		disp(fn);
+		disp("***\033[37m\r\n");
+		return;
+	}
+	const char *ext = fl_filename_ext(fn);
+	int format = TERM_SAVE_TEXT;
+	if ( fl_utf_strcasecmp(ext, ".ans")==0 ) format = TERM_SAVE_ANSI;
+	if ( fl_utf_strcasecmp(ext, ".htm")==0 || fl_utf_strcasecmp(ext, ".html")==0 )
+		format = TERM_SAVE_HTML;
+	for ( int i=0; i<16; i++ )		//0-7 are RGB already, 8-15 FLTK colors
+		save_rgb[i] = (i<8 ? VT_attr[i] : Fl::get_color(VT_attr[i]))>>8;
+	save_line = line_first;
+	save_last = cursor_y;
+	save_pct = 0;
+	std::thread new_saver(&Fl_Term::save_worker, this, fp, format, strdup(fn));
+	saver.swap(new_saver);
+}
+//lines are copied out under lock() a chunk at a time, then formatted
+//and written without it, so draw() and append() only wait for the copy
+void Fl_Term::save_worker(FILE *fp, int format, char *fn)
 {
-	line[++cursor_y]=cursor_x;
-	if ( screen_y==cursor_y-size_y ) screen_y++;
-	if ( line[cursor_y+1]<cursor_x ) line[cursor_y+1]=cursor_x;
+	char *text = (char *)malloc(TERM_SAVE_CHUNK);
+	char *attrs = (char *)malloc(TERM_SAVE_CHUNK);
+	char *out = (char *)malloc(65536);
+	if ( format==TERM_SAVE_HTML ) 
+		fprintf(fp, "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\">"
+				"<title>%s</title></head>\n<body style=\"background:#%06x\">"
+				"<pre style=\"color:#%06x\">", fl_filename_name(fn),
+				save_rgb[0], save_rgb[7]);
+	long long total = 0;
+	char last = 7;				//attribute of the text written last
+	while ( text!=NULL && attrs!=NULL && out!=NULL ) {
+		lock();
+		if ( save_line<line_first ) save_line = line_first; //scrolled out
+		int y = save_line;
+		int last_y = save_last<cursor_y ? save_last : cursor_y;
+		if ( y>last_y ) {
+			unlock();
+			break;
+		}
+		int a = line[y], z = a;		//rows are shorter than TERM_LINE_ROOM,
+		while ( y<=last_y && line[y+1]-a<=TERM_SAVE_CHUNK ) z = line[++y];
+		if ( y==save_line ) z = a+TERM_SAVE_CHUNK, y++;	//cut, just in case
+		if ( z<a ) z = a;			//so each chunk holds many of them
+		thaw(a, z-a);
+		buff.get(text, a, z-a);
+		for ( int j=a, k=-1; j<z; ) {
+			char c;
+			int n = attr.run(k, j, c);
+			if ( n>z ) n = z;
+			memset(attrs+j-a, c, n-j);
+			j = n;
+		}
+		save_line = y;
+		save_pct = (y-line_first)*100LL/(last_y+2-line_first);
+		unlock();
 
-	if ( cursor_x>buff_size-1024 || cursor_y>line_size-3 ) {
-		Fl::lock();
-		if ( line_size<65536 ) {	//double buffer size till 64k lines
-			char *old_buff = buff;
-			char *old_attr = attr;
-			int *old_line = line;
-			buff = (char *)realloc(buff, buff_size*2);
-			attr = (char *)realloc(attr, buff_size*2);
-			line = (int  *)realloc(line, (line_size*2)*sizeof(int));
-			if ( buff!=NULL && attr!=NULL && line!=NULL ) {
-				memset(line+line_size, 0, line_size*sizeof(int));
-				memset(buff+buff_size, 0, buff_size);
-				memset(attr+buff_size, 0, buff_size);
-				buff_size*=2;
-				line_size*=2;
+		char *o = out;
+		for ( int i=0; i<z-a; i++ ) {
+			if ( o-out>65536-128 ) {	//room for a span and a character
+				fwrite(out, 1, o-out, fp);
+				o = out;
 			}
-			else {//clear buffer if failed to double
-				if ( attr==NULL ) attr = old_attr;
-				if ( buff==NULL ) buff = old_buff;
-				if ( line==NULL ) line = old_line;
-				clear();
+			char c = text[i], v = attrs[i];
+			if ( c==0 ) c = ' ';		//never written, like draw() shows
+			if ( format!=TERM_SAVE_TEXT && v!=last && c!='\n' ) {
+				int fg = v&0x0f, bg = (v>>4)&0x0f;
+				if ( format==TERM_SAVE_ANSI ) 
+					o += sprintf(o, "\033[0;%d;%dm", fg<8 ? 30+fg : 82+fg, 
+												bg<8 ? 40+bg : 92+bg);
+				else {
+					if ( last!=7 ) o += sprintf(o, "</span>");
+					if ( v!=7 ) o += sprintf(o, "<span style=\"color:#%06x;"
+										"background:#%06x\">", save_rgb[fg],
+										save_rgb[bg]);
+				}
+				last = v;
 			}
+			if ( format==TERM_SAVE_HTML && (c=='<' || c=='>' || c=='&') )
+				o += sprintf(o, c=='<' ? "&lt;" : (c=='>' ? "&gt;" : "&amp;"));
+			else
+				*o++ = c;
 		}
-		else {						//erase half of buffer at 64k lines
-			int middle = line[32768];
-			for ( int i=32768; i<cursor_y+2; i++ ) line[i]-=middle;
-			memmove(line, line+32768, 32768*sizeof(int));
-			memset(line+32768, 0, 32768*sizeof(int));
-			screen_y-=32768; if ( screen_y<0 ) screen_y=0;
-			cursor_y-=32768;
-			cursor_x-=middle;
-			recv0-=middle; if ( recv0<0 ) recv0=0;
-			memmove(attr, attr+middle, line[cursor_y+1]);
-			memset(attr+line[cursor_y+1], 0, 65536*64-line[cursor_y+1]);
-			memmove(buff, buff+middle, line[cursor_y+1]);
-			memset(buff+line[cursor_y+1], 0, 65536*64-line[cursor_y+1]);
+		fwrite(out, 1, o-out, fp);
+		total += z-a;
+	}
+	if ( format==TERM_SAVE_ANSI ) fprintf(fp, "\033[0m");
+	if ( format==TERM_SAVE_HTML ) 
+		fprintf(fp, "%s</pre></body></html>\n", last!=7 ? "</span>" : "");
+	bool ok = text!=NULL && attrs!=NULL && out!=NULL && !ferror(fp);
+	fclose(fp);
+	free(text);
+	free(attrs);
+	free(out);
+	char msg[MAX_PATH+64];
+	snprintf(msg, sizeof(msg), ok ? "\r\n\033[32m***%lld bytes saved to %s***"
+						"\033[37m\r\n" : "\r\n\033[31m***%lld bytes, failed "
+						"to save %s***\033[37m\r\n", total, fn);
+	free(fn);
+	save_pct = -1;
+	disp(msg);
+}
+//a captured log is mapped read-only and fed to the parser only as far as
+//asked for, a page at a time. A checkpoint is kept every TERM_REPLAY_STEP
+//bytes the first time through, so jumping back, or forward over a part
+//parsed before, resumes from the nearest one instead of from byte 0
+int Fl_Term::replay(const char *fn)
+{
+	if ( host->live() || replay_map!=NULL ) return 0;
+	long long size = 0;
+	const char *p = term_map(fn, &size);
+	if ( p==NULL ) {
+		disp("\r\n\033[31m***failed to open ");
+		disp(fn);
+		disp("***\033[37m\r\n");
+		return 0;
+	}
+	clear();
+	replay_pos = 0;
+	replay_mark();			//marks[0], the cleared screen at 0
+	if ( mark_cnt==0 ) {
+		term_unmap(p, size);
+		return 0;
+	}
+	replay_map = p;
+	replay_size = size;
+	replay_goal = size<TERM_REPLAY_PAGE ? size : TERM_REPLAY_PAGE;
+	strncpy(sTitle, fl_filename_name(fn), 40);
+	sTitle[40] = 0;
+	copy_label(sTitle);
+	std::thread new_replayer(&Fl_Term::replay_worker, this);
+	replayer.swap(new_replayer);
+	do_callback(this, (void *)sTitle);
+	return 1;
+}
+//stop the worker and let go of the log and checkpoints, so the tab can
+//connect or replay again. The worker may wait for the FLTK lock to append
+void Fl_Term::replay_end()
+{
+	if ( replayer.joinable() ) {
+		replay_mtx.lock();
+		replay_stop = true;
+		replay_mtx.unlock();
+		replay_cv.notify_all();
+		bool gui = std::this_thread::get_id()==gui_thread;
+		if ( gui ) Fl::unlock();
+		replayer.join();
+		if ( gui ) Fl::lock();
+		replay_stop = false;
+	}
+	for ( int i=0; i<mark_cnt; i++ ) free(marks[i].pack);
+	mark_cnt = 0;
+	if ( replay_map!=NULL ) term_unmap(replay_map, replay_size);
+	replay_map = NULL;
+}
+void Fl_Term::replay_worker()
+{
+	long long aim = -1;		//goal the feed was last planned for
+	for ( ;; ) {
+		long long goal;
+		{
+			std::unique_lock<std::mutex> lck(replay_mtx);
+			replay_cv.wait(lck, [this, aim]{ return replay_stop ||
+							replay_goal!=aim || replay_pos<replay_goal; });
+			if ( replay_stop ) break;
+			goal = replay_goal;
 		}
-		Fl::unlock();
+		if ( goal!=aim ) {	//restore only to go back or to skip ahead
+			aim = goal;
+			int k = mark_cnt-1;
+			while ( k>0 && marks[k].pos>goal-TERM_REPLAY_BACK ) k--;
+			if ( goal<replay_pos || marks[k].pos>replay_pos )
+				replay_restore(marks+k);
+		}
+		long long n = goal-replay_pos;
+		if ( n<=0 ) continue;
+		if ( n>HOST_RX_CHUNK ) n = HOST_RX_CHUNK;
+		flow_bytes += n;	//the log is plain text, whatever host was last
+		append(replay_map+replay_pos, n);
+		replay_pos += n;
+		if ( replay_pos>=marks[mark_cnt-1].pos+TERM_REPLAY_STEP ) 
+			replay_mark();	//retried after the next chunk if it can't
 	}
 }
-void Fl_Term::append( const char *newtext, int len )
+void Fl_Term::replay_mark()
 {
-	const unsigned char *p = (const unsigned char *)newtext;
-	const unsigned char *zz = p+len;
-	
-	append_mtx.lock();	//only one thread can append to buffer at a time
-	if ( fpLogFile!=NULL ) fwrite( newtext, 1, len, fpLogFile );
-	if ( bEscape ) p = vt100_Escape( p, zz-p );
-	while ( p < zz ) {
-		unsigned char c=*p++;
-		if ( bTitle ) {
-			if ( c==0x07 ) {
-				bTitle = false;
-				sTitle[title_idx]=0;
-				do_callback( this, (void *)sTitle );
-			}
-			else {
-				if ( title_idx<128 ) sTitle[title_idx++] = c;
-			}
+	if ( mark_cnt==mark_room ) {
+		int room = mark_room>0 ? mark_room*2 : 64;
+		Fl_Term_Mark *p = (Fl_Term_Mark *)realloc(marks,
+											room*sizeof(Fl_Term_Mark));
+		if ( p==NULL ) return;
+		marks = p;
+		mark_room = room;
+	}
+	lock();				//for thaw(), always before append_mtx
+	append_mtx.lock();
+	if ( bEscape || bTitle ) {	//only between escape sequences
+		append_mtx.unlock();
+		unlock();
+		return;
+	}
+	int top = cursor_y-size_y+1;	//the screen, rows below the cursor too
+	if ( bAltScreen || screen_y>top ) top = screen_y;
+	if ( top>cursor_y ) top = cursor_y;
+	if ( top<line_first ) top = line_first;
+	int rows = cursor_y+1-top;
+	while ( rows<size_y && line[top+rows+1]>line[top+rows] ) rows++;
+	int total = 0;
+	for ( int i=top; i<top+rows; i++ ) {
+		int n = line[i+1]-line[i];
+		total += n<0 ? 0 : (n>TERM_LINE_ROOM ? TERM_LINE_ROOM : n);
+	}
+	int len = rows*sizeof(int)+total*2;
+	char *raw = (char *)malloc(len);
+	if ( raw==NULL ) {
+		append_mtx.unlock();
+		unlock();
+		return;
+	}
+	int *lens = (int *)raw;
+	char *text = raw+rows*sizeof(int);
+	char *attrs = text+total;
+	thaw(line[top], line[top+rows]-line[top]);
+	for ( int i=0; i<rows; i++ ) {
+		int a = line[top+i], n = line[top+i+1]-a;
+		n = n<0 ? 0 : (n>TERM_LINE_ROOM ? TERM_LINE_ROOM : n);
+		lens[i] = n;
+		buff.get(text, a, n);
+		for ( int j=a, k=-1; j<a+n; ) {
+			char c;
+			int z = attr.run(k, j, c);
+			if ( z>a+n ) z = a+n;
+			memset(attrs+j-a, c, z-j);
+			j = z;
+		}
+		text += n;
+		attrs += n;
+	}
+	Fl_Term_Mark &m = marks[mark_cnt];
+	m.pos = replay_pos;
+	m.len = len;
+	m.rows = rows;
+	m.cy = cursor_y-top;
+	m.cx = cursor_x-line[cursor_y];
+	m.save_x = save_x;
+	m.save_y = save_y;
+	m.roll_top = roll_top;
+	m.roll_bot = roll_bot;
+	m.modes = bInsert|bGraphic<<1|bCursor<<2|bAppCursor<<3|bAltScreen<<4|
+				bBracket<<5|bWraparound<<6|bOriginMode<<7;
+	m.c_attr = c_attr;
+	m.save_attr = save_attr;
+	memcpy(m.tabstops, tabstops, 256);
+	append_mtx.unlock();
+	unlock();
+	m.pack = term_pack(raw, len);
+	free(raw);
+	if ( m.pack!=NULL ) mark_cnt++;
+}
+void Fl_Term::replay_restore(Fl_Term_Mark *m)
+{
+	char *raw = (char *)malloc(m->len);
+	if ( raw==NULL || !term_unpack(m->pack, raw, m->len) ) {
+		free(raw);
+		return;
+	}
+	int *lens = (int *)raw;
+	const char *text = raw+m->rows*sizeof(int);
+	int total = 0;
+	for ( int i=0; i<m->rows; i++ ) total += lens[i];
+	const char *attrs = text+total;
+
+	srch_stop();
+	lock();
+	append_mtx.lock();
+	reset();
+	bScrollbar = false;
+	for ( int i=0; i<m->rows; i++ ) {	//rows go back in from line 0
+		cursor_y = i;
+		cursor_x = line[i];
+		more_room();
+		buff.put(cursor_x, text, lens[i]);
+		for ( int j=0; j<lens[i]; ) {
+			int k = j;
+			while ( k<lens[i] && attrs[k]==attrs[j] ) k++;
+			attr.fill(cursor_x+j, attrs[j], k-j);
+			j = k;
+		}
+		line[i+1] = cursor_x+lens[i];
+		text += lens[i];
+		attrs += lens[i];
+	}
+	cursor_y = m->cy;
+	cursor_x = line[cursor_y]+m->cx;
+	screen_y = 0;
+	more_room();
+	save_x = m->save_x;
+	save_y = m->save_y;
+	roll_top = m->roll_top;
+	roll_bot = m->roll_bot;
+	bInsert = m->modes&1;
+	bGraphic = m->modes&2;
+	bCursor = m->modes&4;
+	bAppCursor = m->modes&8;
+	bAltScreen = m->modes&16;
+	bBracket = m->modes&32;
+	bWraparound = m->modes&64;
+	bOriginMode = m->modes&128;
+	c_attr = m->c_attr;
+	save_attr = m->save_attr;
+	memcpy(tabstops, m->tabstops, 256);
+	replay_pos = m->pos;
+	reclaim();
+	append_mtx.unlock();
+	unlock();
+	free(raw);
+	pending(true);
+}
+void Fl_Term::replay_keys(const char *buf, int len)
+{//like less, space or enter/b a page forward/back, g/G start/end, N% jump
+	std::lock_guard<std::mutex> lck(replay_mtx);
+	long long goal = replay_goal;
+	for ( int i=0; i<len; i++ ) {
+		char c = buf[i];
+		if ( c>='0' && c<='9' ) {
+			if ( replay_num<100 ) replay_num = replay_num*10+c-'0';
 			continue;
 		}
 		switch ( c ) {
-			case 0x00:
-			case 0x0e:
-			case 0x0f:	break;
-			case 0x07:	fl_beep(FL_BEEP_DEFAULT); break;
-			case 0x08:
-				if ( cursor_x>line[cursor_y] ) {
-					if ( (buff[cursor_x--]&0xc0)==0x80 )//utf8 continuation byte
-						while ( (buff[cursor_x]&0xc0)==0x80 )
-							cursor_x--;
-				}
-				break;
-			case 0x09:{
-				int l;
-				do {
-					attr[cursor_x]=c_attr;
-					buff[cursor_x++]=' ';
-				 	l=cursor_x-line[cursor_y];
-				} while ( l<=size_x && tabstops[l]==0 );
-			}
-					break;
-			case 0x0a:
-			case 0x0b:
-			case 0x0c:
-				if ( bAltScreen || line[cursor_y+2]!=0 ) { //IND to next line
-						vt100_Escape((unsigned char *)"D", 1);
-				}
-				else {	//LF and newline
-					cursor_x = line[cursor_y+1]	;
-					attr[cursor_x] = c_attr;
-					buff[cursor_x++] = 0x0a;
-					next_line();
-				}
-				break;
-			case 0x0d:
-				if ( cursor_x-line[cursor_y]==size_x+1 && *p!=0x0a )
-					next_line();//soft line feed
-				else
-					cursor_x = line[cursor_y];
-				break;
-			case 0x1b:
-				p = vt100_Escape(p, zz-p);
-				break;
-			case 0xff:
-				p = telnet_options(p-1, zz-p+1);
-				break;
-		case 0xe2:
-			if ( bAltScreen ) {//utf8 box drawing hack
-				c = ' ';
-				if ( *p++==0x94 ) {
-					switch ( *p ) {
-						case 0x80:
-						case 0xac:
-						case 0xb4:
-						case 0xbc: c='_'; break;
-						case 0x82:
-						case 0x94:
-						case 0x98:
-						case 0x9c:
-						case 0xa4: c='|'; break;
-						}
-					}
-					p++;
-				}//fall through
-		default:
-			if ( bGraphic ) {
-				switch ( c ){//charset 2 box drawing
-					case 'q': c='_'; break;
-					case 'x': c='|';
-					case 't':
-					case 'u':
-					case 'm':
-					case 'j': c='|'; break;
-					case 'l':
-					case 'k': c=' '; break;
-					default: c = '?';
-				}
-			}
-			if ( bInsert )		//insert one space
-				vt100_Escape((unsigned char *)"[1@",3);
-			if ( cursor_x-line[cursor_y]>=size_x ) {
-				int char_cnt = 0;
-				for ( int i=line[cursor_y]; i<cursor_x; i++ )
-					if ( (buff[i]&0xc0)!=0x80 ) char_cnt++;
-				if ( char_cnt==size_x ) {
-					if ( bWraparound  )
-					next_line();
-					else
-						cursor_x--;
-				}
-			}
-			attr[cursor_x] = c_attr;
-			buff[cursor_x++] = c;
-			if ( line[cursor_y+1]<cursor_x )
-				line[cursor_y+1]=cursor_x;
+		case ' ':
+		case '\r': goal += TERM_REPLAY_PAGE; break;
+		case 'b': goal -= TERM_REPLAY_PAGE; break;
+		case 'g': goal = 0; break;
+		case 'G': goal = replay_size; break;
+		case '%': goal = replay_size*(replay_num<100 ? replay_num : 100)/100;
 		}
+		replay_num = 0;
 	}
-	if ( !bPrompt && cursor_x>iPrompt ) {
-		char *p=buff+cursor_x-iPrompt;
-		if ( strncmp(p, sPrompt, iPrompt)==0 ) bPrompt=true;
+	long long first = replay_size<TERM_REPLAY_PAGE ? replay_size 
+													: TERM_REPLAY_PAGE;
+	if ( goal<first ) goal = first;		//always a page to look at
+	if ( goal>replay_size ) goal = replay_size;
+	replay_goal = goal;
+	replay_cv.notify_all();
+}
+void Fl_Term::sel_show()
+{//scroll the selection into view
+	while ( screen_y>line_first && line[screen_y]>sel_left ) screen_y--;
+	while ( screen_y<cursor_y-size_y+1 && line[screen_y+size_y]<=sel_left )
+		screen_y++;
+	bScrollbar = (screen_y < cursor_y-size_y+1);
+}
+void Fl_Term::srch(const char *sstr, bool back)
+{//from the selection backward or forward, or from the cursor/top
+	char up[256];
+	int l = strlen(sstr);
+	if ( l>255 ) l = 255;
+	for ( int i=0; i<l; i++ ) up[i] = toupper((unsigned char)sstr[i]);
+	int start = line[line_first];
+	int p;
+	if ( back )
+		p = find(up, l, start, sel_left<sel_right && sel_left+l-1<cursor_x ?
+								sel_left+l-1 : cursor_x, true);
+	else
+		p = find(up, l, sel_left<sel_right ? sel_left+1 : start, cursor_x, false);
+	if ( p>=0 ) {
+		sel_left = p;
+		sel_right = p+l;
+		sel_show();
 	}
-	pending(true);
-	append_mtx.unlock();
+	else
+		sel_left = sel_right = 0;
+	redraw();
 }
-void Fl_Term::buff_clear(int offset, int len)
-{
-	memset(buff+offset, ' ', len);
-	memset(attr+offset,   7, len);
+bool Fl_Term::hit_add(int **p, int *cnt, int *room, int a, int z)
+{//append match [a, z) to a list of pairs
+	if ( *cnt==*room ) {
+		int n = *room*2+256;
+		int *q = (int *)realloc(*p, n*2*sizeof(int));
+		if ( q==NULL ) return false;
+		*p = q;
+		*room = n;
+	}
+	(*p)[*cnt*2] = a;
+	(*p)[*cnt*2+1] = z;
+	(*cnt)++;
+	return true;
 }
-/*[2J, mostly used after [?1049h to clear screen
-  and when screen size changed during vi or raspi-config
-  flashwave TL1 use it without [?1049h for splash screen
-  freeBSD use it without [?1049h* for top and vi
-*/
-void Fl_Term::screen_clear(int m0)
-{
-	int lines = size_y;
-	if ( m0==2 ) screen_y = cursor_y;
-	if ( m0==1 ) {
-		lines = cursor_y-screen_y;
-		buff_clear(line[cursor_y], cursor_x-line[cursor_y]+1);
-		cursor_y = screen_y;
-	}
-	if ( m0==0 ) {
-		buff_clear(cursor_x, line[cursor_y+1]-cursor_x);
-		lines = screen_y+size_y-cursor_y;
-	}
-	cursor_x = line[cursor_y];
-	int cy = cursor_y;
-	for ( int i=0; i<lines; i++ ) {
-		buff_clear(cursor_x, size_x);
-		cursor_x += size_x;
-		next_line();
-	}
-	cursor_y = cy;
-	if ( m0==2 || m0==0 ) screen_y--;
-	cursor_x = line[cursor_y];
+int Fl_Term::srch_all(const char *sstr)
+{//highlight every match, returns the number of matches
+	char up[256];
+	int l = strlen(sstr);
+	if ( l>255 ) l = 255;
+	for ( int i=0; i<l; i++ ) up[i] = toupper((unsigned char)sstr[i]);
+	srch_stop();
+	hit_cnt = 0;
+	for ( int i=find(up, l, line[line_first], cursor_x, false); i>=0;
+			i=find(up, l, i+l, cursor_x, false) )
+		if ( !hit_add(&hits, &hit_cnt, &hit_room, i, i+l) ) break;
+	redraw();
+	return hit_cnt;
 }
-void Fl_Term::check_cursor_y()
-{
-	if ( cursor_y< screen_y )
-		cursor_y = screen_y;
-	if ( cursor_y> screen_y+size_y-1 )
-		cursor_y = screen_y+size_y-1;
-	if ( bOriginMode ) {
-		if ( cursor_y<screen_y+roll_top )
-			cursor_y = screen_y+roll_top;
-		if ( cursor_y>screen_y+roll_bot )
-			cursor_y = screen_y+roll_bot;
+void Fl_Term::srch_next(bool back)
+{//select the match before or after the selection
+	int p = sel_left<sel_right ? sel_left : (back ? cursor_x : -1);
+	int lo = 0, hi = hit_cnt;	//first match starting after p
+	while ( lo<hi ) {
+		int mid = (lo+hi)/2;
+		if ( hits[mid*2]<=p ) lo = mid+1;
+		else hi = mid;
 	}
+	if ( back ) lo -= (lo>0 && hits[lo*2-2]==p) ? 2 : 1;
+	if ( lo<0 || lo>=hit_cnt ) return;
+	sel_left = hits[lo*2];
+	sel_right = hits[lo*2+1];
+	sel_show();
+	redraw();
 }
-void Fl_Term::termsize(int cols, int rows)
+//regular expression search runs on a copy of the line positions, and
+//fetches the text a chunk at a time, so the parser and draw() never wait
+//for it. Matches are handed over in batches through srch_found, draw()
+//moves them to hits
+int Fl_Term::srch_regex(const char *expr)
 {
-	if ( size_x!=cols || size_y!=rows ) {
-		size_x=cols; size_y=rows;
-		screen_clear(2);
-		do_callback(this, (void *)sTitle);	//trigger window resizing
+	srch_stop();
+	hit_cnt = 0;
+	redraw();
+	std::regex *re;
+	try {
+		re = new std::regex(expr, std::regex::icase|std::regex::optimize);
 	}
+	catch ( const std::regex_error & ) {
+		return -1;
+	}
+	int first = line_first;
+	int cnt = cursor_y+1-first;
+	int base = line[first];
+	int len = line[cursor_y+1]-base;
+	if ( len<0 ) len = 0;
+	int *lines = (int *)malloc((cnt+1)*sizeof(int));
+	if ( lines==NULL ) {
+		delete re;
+		return -1;
+	}
+	for ( int i=0; i<=cnt; i++ ) {
+		int l = line[first+i]-base;
+		lines[i] = l<0 ? 0 : (l>len ? len : l);
+	}
+	srch_shift = 0;
+	std::thread worker(&Fl_Term::srch_regex_worker, this, re, lines, cnt, base);
+	srch_worker.swap(worker);
+	return 0;
 }
-const unsigned char *Fl_Term::vt100_Escape(const unsigned char *sz, int cnt)
+void Fl_Term::srch_regex_worker(std::regex *re, int *lines, int cnt, int base)
 {
-	const unsigned char *zz = sz+cnt;
-	bEscape = true;
-	while ( sz<zz && bEscape ){
-		if ( *sz>31 )
-			ESC_code[ESC_idx++] = *sz++;
-		else {
-			switch ( *sz++ ) {
-			case 0x08:	//BS
-					if ( (buff[cursor_x--]&0xc0)==0x80 )//utf8 continuation byte
-						while ( (buff[cursor_x]&0xc0)==0x80 ) cursor_x--;
-					break;
-			case 0x0b: {//VT
-					int x = cursor_x-line[cursor_y];
-					cursor_x = line[++cursor_y]+x;
-					break;
-					}
-			case 0x0d:	//CR
-					cursor_x = line[cursor_y];
-					break;
-			}
-		}
-		switch( ESC_code[0] ) {
-		case '[':
-			if ( isalpha(ESC_code[ESC_idx-1])
-				|| ESC_code[ESC_idx-1]=='@'
-				|| ESC_code[ESC_idx-1]=='`' ) {
-				bEscape = false;
-				int m0=0;	//used by [PsJ and [PsK
-				int n0=1;	//used by most, e.g. [PsA [PsB
-				int n1=1;	//n1;n0 used by [Ps;PtH [Ps;Ptr
-				if ( isdigit(ESC_code[1]) ) {
-					m0 = n0 = atoi(ESC_code+1);
-					if ( n0==0 ) n0=1;
-				}
-				char *p = strchr(ESC_code,';');
-				if ( p != NULL ) {
-					n1 = n0;
-					n0 = atoi(p+1);
-					if ( n0==0 ) n0=1;	//ESC[0;0f == ESC[1;1f
-				}
-				int x;
-				switch ( ESC_code[ESC_idx-1] ) {
-				case 'A': //cursor up n0 times
-					x = cursor_x-line[cursor_y];
-					cursor_y -=n0;
-					check_cursor_y();
-					cursor_x = line[cursor_y]+x;
-					break;
-				case 'd'://line position absolute
-					x = cursor_x-line[cursor_y];
-					if ( n0>size_y ) n0 = size_y;
-					cursor_y = screen_y+n0-1;
-					cursor_x = line[cursor_y]+x;
-					break;
-				case 'e': //line position relative
-				case 'B': //cursor down n0 times
-					x = cursor_x-line[cursor_y];
-					cursor_y += n0;
-					check_cursor_y();
-					cursor_x = line[cursor_y]+x;
-					break;
-				case '`': //character position absolute
-				case 'G': //cursor to n0th position from left
-					cursor_x = line[cursor_y];
-					//fall through
-				case 'a': //character position relative
-				case 'C': //cursor forward n0 times
-					while ( n0-->0 && cursor_x<line[cursor_y]+size_x-1 ) {
-						if ( (buff[++cursor_x]&0xc0)==0x80 )
-							while ( (buff[++cursor_x]&0xc0)==0x80 );
-					}
-					break;
-				case 'D': //cursor backward n0 times
-					while ( n0-->0 && cursor_x>line[cursor_y] ) {
-						if ( (buff[--cursor_x]&0xc0)==0x80 )
-							while ( (buff[--cursor_x]&0xc0)==0x80 );
-					}
-					break;
-				case 'E': //cursor to begining of next line n0 times
-					cursor_y += n0;
-					check_cursor_y();
-					cursor_x = line[cursor_y];
-					break;
-				case 'F': //cursor to begining of previous line n0 times
-					cursor_y -= n0;
-					check_cursor_y();
-					cursor_x = line[cursor_y];
-					break;
-				case 'f': //horizontal/vertical position forced, apt install
-					for ( int i=cursor_y+1; i<screen_y+n1; i++ )
-						if ( i<line_size && line[i]<cursor_x )
-							line[i] = cursor_x;
-					//fall through
-				case 'H': //cursor to line n1, postion n0
-					if ( !bAltScreen && n1>size_y ) {
-						cursor_y = (screen_y++) + size_y;
-					}
-					else {
-						cursor_y = screen_y+n1-1;
-						if ( bOriginMode ) cursor_y+=roll_top;
-						check_cursor_y();
-					}
-					cursor_x = line[cursor_y];
-					while ( --n0>0 ) {
-						cursor_x++;
-						while ( (buff[cursor_x]&0xc0)==0x80 ) cursor_x++;
-					}
-					break;
-				case 'J': //[0J kill till end, 1J begining, 2J entire screen
-					if ( isdigit(ESC_code[1]) || bAltScreen ) {
-						screen_clear(m0);
-					}
-					else {//clear in none alter screen, used in apt install
-						line[cursor_y+1] = cursor_x;
-						for (int i=cursor_y+2; i<=screen_y+size_y+1; i++)
-							if ( i<line_size ) line[i] = 0;
-					}
-					break;
-				case 'K': {//[K erase till line end, 1K begining, 2K entire line
-						int a=line[cursor_y];
-						int z=line[cursor_y+1];
-						if ( m0==0 ) a = cursor_x;
-						if ( m0==1 ) z = cursor_x+1;
-						if ( z>a ) buff_clear(a, z-a);
-					}
-					break;
-				case 'L': //insert n0 lines
-					if ( n0 > screen_y+roll_bot-cursor_y )
-						n0 = screen_y+roll_bot-cursor_y+1;
-					else
-						for ( int i=screen_y+roll_bot; i>=cursor_y+n0; i-- ) {
-							memcpy( buff+line[i], buff+line[i-n0], size_x );
-							memcpy( attr+line[i], attr+line[i-n0], size_x );
-						}
-					cursor_x = line[cursor_y];
-					buff_clear(cursor_x, size_x*n0);
-					break;
-				case 'M': //delete n0 lines
-					if ( n0 > screen_y+roll_bot-cursor_y )
-						n0 = screen_y+roll_bot-cursor_y+1;
-					else
-						for ( int i=cursor_y; i<=screen_y+roll_bot-n0; i++ ) {
-							memcpy( buff+line[i], buff+line[i+n0], size_x);
-							memcpy( attr+line[i], attr+line[i+n0], size_x);
-						}
-					cursor_x = line[cursor_y];
-					buff_clear(line[screen_y+roll_bot-n0+1], size_x*n0);
-					break;
-				case 'P': //delete n0 characters
-					for ( int i=cursor_x+n0; i<line[cursor_y+1]; i++ ) {
-						buff[i-n0]=buff[i];
-						attr[i-n0]=attr[i];
-					}
-					buff_clear(line[cursor_y+1]-n0, n0);
-					if ( !bAltScreen ) {
-						line[cursor_y+1]-=n0;
-						if ( line[cursor_y+1]<line[cursor_y] )
-							line[cursor_y+1] =line[cursor_y];
-					}
-					break;
-				case '@': //insert n0 spaces
-					for ( int i=line[cursor_y+1]-n0-1; i>=cursor_x; i-- ){
-						buff[i+n0]=buff[i];
-						attr[i+n0]=attr[i];
-					}
-					if ( !bAltScreen ) {
-						line[cursor_y+1]+=n0;
-						if ( line[cursor_y+1]>line[cursor_y]+size_x )
-							line[cursor_y+1] =line[cursor_y]+size_x;
-					}//fall through
-				case 'X': //erase n0 characters
-					buff_clear(cursor_x, n0);
-					break;
-				case 'I': //cursor forward n0 tab stops
-					break;
-				case 'Z': //cursor backward n0 tab stops
-					break;
-				case 'S': // scroll up n0 lines
-					for ( int i=roll_top; i<=roll_bot-n0; i++ ) {
-						memcpy( buff+line[screen_y+i],
-								buff+line[screen_y+i+n0], size_x);
-						memcpy( attr+line[screen_y+i],
-								attr+line[screen_y+i+n0], size_x);
-					}
-					buff_clear(line[screen_y+roll_bot-n0+1], n0*size_x);
-					break;
-				case 'T': // scroll down n0 lines
-					for ( int i=roll_bot; i>=roll_top+n0; i-- ) {
-						memcpy( buff+line[screen_y+i],
-								buff+line[screen_y+i-n0], size_x);
-						memcpy( attr+line[screen_y+i],
-								attr+line[screen_y+i-n0], size_x);
-					}
-					buff_clear(line[screen_y+roll_top], n0*size_x);
-					break;
-				case 'c': // send device attributes
-					send("\033[?1;2c");		//vt100 with options
-					break;
-				case 'g': // set tabstops
-					if ( m0==0 ) { //clear current tab
-						tabstops[cursor_x-line[cursor_y]] = 0;
-					}
-					if ( m0==3 ) { //clear all tab stops
-						memset(tabstops, 0, 256);
-					}
-					break;
-				case 'h':
-					if ( ESC_code[1]=='4' ) bInsert=true;
-					if ( ESC_code[1]=='?' ) {
-						switch( atoi(ESC_code+2) ) {
-						case 1: bAppCursor = true; 	break;
-						case 3:	termsize(132, 25);  break;
-						case 6: bOriginMode = true; break;
-						case 7: bWraparound = true; break;
-						case 25:	bCursor = true; break;
-						case 2004: bBracket = true; break;
-						case 1049: bAltScreen = true;//?1049h alternate screen
-								screen_clear(2);
-						}
-					}
-					break;
-				case 'l':
-					if ( ESC_code[1]=='4' ) bInsert=false;
-					if ( ESC_code[1]=='?' ) {
-						switch( atoi(ESC_code+2) ) {
-						case 1: bAppCursor = false; break;
-						case 3:	termsize(80, 25);   break;
-						case 6: bOriginMode= false; break;
-						case 7: bWraparound= false; break;
-						case 25:	bCursor= false; break;
-						case 2004: bBracket= false; break;
-						case 1049: bAltScreen= false;//?1049l alternate screen
-								cursor_y = screen_y;
-								cursor_x = line[cursor_y];
-								for ( int i=1; i<=size_y+1; i++ )
-									line[cursor_y+i] = 0;
-								screen_y = cursor_y-size_y+1;
-								if ( screen_y<0 ) screen_y = 0;
-						}
-					}
-					break;
-				case 'm': {//text style, color attributes
-						char *p = ESC_code;
-						while ( p!=NULL ) {
-							m0 = atoi(++p);
-							switch ( m0/10 ) {
-							case 0: if ( m0==0 ) c_attr = 7;	//normal
-									if ( m0==1 ) c_attr|=0x08;	//bright
-									if ( m0==7 ) c_attr =0x70;	//negative
-									break;
-							case 2: c_attr = 7; 				//normal
-									break;
-							case 3: if ( m0==39 ) m0 = 7;//default foreground
-									c_attr = (c_attr&0xf8)+m0%10;
-									break;
-							case 4: if ( m0==49 ) m0 = 0;//default background
-									c_attr = (c_attr&0x0f)+((m0%10)<<4);
-									break;
-							case 9: c_attr = (c_attr&0xf0) + m0%10 + 8;
-									break;
-							case 10:c_attr = (c_attr&0x0f) + ((m0%10+8)<<4);
-									break;
-							}
-							p = strchr(p, ';');
-						}
-					}
-					break;
-				case 'r': //set margins and move cursor to home
-					if ( n1==1 && n0==1 ) n0=size_y;	//ESC[r
-					roll_top=n1-1; roll_bot=n0-1;
-					cursor_y = screen_y;
-					if ( bOriginMode ) cursor_y+=roll_top;
-					cursor_x = line[cursor_y];
-					break;
-				case 's': //save cursor
-					save_x = cursor_x-line[cursor_y];
-					save_y = cursor_y-screen_y;
-					break;
-				case 'u': //restore cursor
-					cursor_y = save_y+screen_y;
-					cursor_x = line[cursor_y]+save_x;
-					break;
-				}
-			}
-			break;
-		case '7': //save cursor
-			save_x = cursor_x-line[cursor_y];
-			save_y = cursor_y-screen_y;
-			save_attr = c_attr;
-			bEscape = false;
-			break;
-		case '8': //restore cursor
-			cursor_y = save_y+screen_y;
-			cursor_x = line[cursor_y]+save_x;
-			c_attr = save_attr;
-			bEscape = false;
-			break;
-		case 'F': //cursor to lower left corner
-			cursor_y = screen_y+size_y-1;
-			cursor_x = line[cursor_y];
-			bEscape = false;
-			break;
-		case 'E': //move to next line
-			cursor_x = line[++cursor_y];
-			bEscape = false;
-			break;
-		case 'D': //move/scroll up one line
-			if ( cursor_y<screen_y+roll_bot ) {	//move
-				int x = cursor_x-line[cursor_y];
-				cursor_x = line[++cursor_y]+x;
-			}
-			else {								//scroll
-				int len = line[screen_y+roll_bot+1]-line[screen_y+roll_top+1];
-				int x = cursor_x-line[cursor_y];
-				memcpy(buff+line[screen_y+roll_top], 
-						buff+line[screen_y+roll_top+1], len);
-				memcpy(attr+line[screen_y+roll_top], 
-						attr+line[screen_y+roll_top+1], len);
-				len = line[screen_y+roll_top+1]-line[screen_y+roll_top];
-				for ( int i=roll_top+1; i<=roll_bot; i++ )
-					line[screen_y+i] = line[screen_y+i+1]-len;
-				buff_clear(line[screen_y+roll_bot], 
-					line[screen_y+roll_bot+1]-line[screen_y+roll_bot]);
-				cursor_x = line[cursor_y]+x;
-			}
-			bEscape = false;
-			break;
-		case 'M': //move/scroll down one line
-			if ( cursor_y>screen_y+roll_top ) {	// move
-				int x = cursor_x-line[cursor_y];
-				cursor_x = line[--cursor_y]+x;
-			}
-			else {								//scroll
-				for ( int i=roll_bot; i>roll_top; i-- ) {
-					memcpy(buff+line[screen_y+i],buff+line[screen_y+i-1],size_x);
-					memcpy(attr+line[screen_y+i],attr+line[screen_y+i-1],size_x);
-				}
-				buff_clear(line[screen_y+roll_top], size_x);
-			}
-			bEscape = false;
-			break;
-		case 'H': //set tabstop
-			tabstops[cursor_x-line[cursor_y]] = 1;
-			bEscape = false;
-			break;
-		case ']': //set window title
-			if ( ESC_code[ESC_idx-1]==';' ) {
-				if ( ESC_code[1]=='0' ) {
-					bTitle = true;
-					title_idx = 0;
-				}
-				bEscape = false;
+	const int chunk = 1<<TERM_CHUNK_BITS;
+	int *found = NULL;
+	int found_cnt = 0, found_room = 0;
+	char *text = NULL;			//[from, to) of the buffer, whole chunks
+	int from = base&~(chunk-1);	//fetched up to to
+	int to = from, room = 0;
+	int lost_a = from, lost_z = from;	//chunks that had scrolled out
+	for ( int i=0; i<cnt && !srch_cancel; i++ ) {
+		int a = base+lines[i];
+		int z = base+lines[i+1];
+		while ( to<z && !srch_cancel ) {
+			int drop = (a<to ? a : to)-from;	//lines before a are done
+			if ( drop>0 ) memmove(text, text+drop, to-from-drop);
+			from += drop;
+			if ( to-from+chunk>room ) {
+				char *p = (char *)realloc(text, to-from+chunk);
+				if ( p==NULL ) break;
+				text = p;
+				room = to-from+chunk;
 			}
-			break;
-		case ')':
-		case '(': //character sets, 0 for line drawing
-			if ( ESC_idx==2 ) {
-				bGraphic = (ESC_code[1]=='0');
-				bEscape = false;
+			if ( !srch_chunk(to, text+(to-from)) ) {
+				if ( lost_z!=to ) lost_a = to;
+				lost_z = to+chunk;
 			}
-			break;
-		case '#':
-			if ( ESC_idx==2 ) {
-				if ( ESC_code[1]=='8' )
-					memset(buff+line[screen_y], 'E', size_x*size_y);
-				bEscape = false;
+			to += chunk;
+		}
+		if ( to<z ) break;
+		if ( a>=lost_z || z<=lost_a ) {	//skip only lines with lost text
+			const char *p = text+(a-from);
+			for ( std::cregex_iterator m(p, p+(z-a), *re), e; m!=e; ++m ) {
+				if ( m->length()==0 ) continue;
+				int q = a+m->position();
+				hit_add(&found, &found_cnt, &found_room, q, q+m->length());
 			}
-			break;
-		default: bEscape = false;
 		}
-		if ( ESC_idx==31 ) bEscape = false;
-		if ( !bEscape ) { ESC_idx=0; memset(ESC_code, 0, 32); }
+		if ( found_cnt>0 && ((i&1023)==1023 || i==cnt-1) ) {
+			srch_mtx.lock();		//hand over every 1024 lines
+			for ( int j=0; j<found_cnt; j++ )
+				hit_add(&srch_found, &srch_found_cnt, &srch_found_room,
+						found[j*2], found[j*2+1]);
+			srch_mtx.unlock();
+			found_cnt = 0;
+			srch_new = true;
+			pending(true);
+		}
 	}
-	return sz;
+	free(found);
+	free(text);
+	free(lines);
+	delete re;
 }
-void Fl_Term::logg(const char *fn)
-{
-	if ( fpLogFile!=NULL ) {
-		fclose( fpLogFile );
-		fpLogFile = NULL;
-		disp("\r\n\033[32m***logging off ");
-		disp(LogFileName);
-		free(LogFileName);
-		LogFileName = NULL;
+void Fl_Term::hit_merge()
+{//matches from srch_regex_worker come in order, after those already in hits
+	srch_mtx.lock();
+	srch_new = false;
+	for ( int i=0; i<srch_found_cnt; i++ )
+		hit_add(&hits, &hit_cnt, &hit_room, srch_found[i*2]-srch_shift,
+				srch_found[i*2+1]-srch_shift);
+	srch_found_cnt = 0;
+	srch_mtx.unlock();
+}
+void Fl_Term::srch_stop()
+{//cancel the regular expression search, drop matches not taken yet
+	if ( srch_worker.joinable() ) {
+		srch_cancel = true;
+		srch_worker.join();
+		srch_cancel = false;
 	}
-	else {
-		fpLogFile = fl_fopen(fn, "wb");
-		if ( fpLogFile != NULL ) {
-			LogFileName = strdup(fn);
-			disp("\r\n\033[32m***logging on ");
-			disp(LogFileName);
-		}
-		else {
-			disp("\r\n\033[31m***Failed to open logfile");
-		}
+	srch_mtx.lock();
+	srch_found_cnt = 0;
+	srch_new = false;
+	srch_mtx.unlock();
+}
+const char *Fl_Term::reply(int from, int len, Fl_Term_Pin *out)
+{//copy text out of the chunks, so scripts get one contiguous string,
+ //or pin the chunks when the caller sends the pieces out as they are
+	if ( len<0 ) len = 0;
+	if ( out!=NULL ) {
+		pin(from, len, out);
+		return "";
 	}
-	disp("***\033[37m\r\n");
+	char *p = (char *)realloc(reply_buf, len+1);
+	if ( p==NULL ) return "";
+	reply_buf = p;
+	thaw(from, len);
+	buff.get(reply_buf, from, len);
+	reply_buf[len] = 0;
+	return reply_buf;
 }
-void Fl_Term::save(const char *fn)
+//p is a malloc'ed reply, a client of its own gets it as a pin and frees it
+//after sending, scripts get it in reply_buf until their next command
+const char *Fl_Term::reply_keep(char *p, int len, Fl_Term_Pin *out)
 {
-	FILE *fp = fl_fopen(fn, "wb");
-	if ( fp!=NULL ) {
-		for (int i=0; i<cursor_x; i+=8192) {
-			int len = i+8192<cursor_x ? 8192 : cursor_x-i;
-			fwrite(buff+i, 1, len, fp);
-		}
-		fclose(fp);
-		char msg[256];
-		snprintf(msg, 256,
-                 "\r\n\033[32m***%d bytes saved to %s***\03337m\r\n",
-				 cursor_x, fn);
-		disp(msg);
+	if ( p==NULL ) return "";
+	p[len] = 0;
+	if ( out!=NULL ) {
+		term_pin_own(out, p, len);
+		return "";
 	}
+	free(reply_buf);
+	reply_buf = p;
+	return p;
 }
-void Fl_Term::srch(const char *sstr)
+//strings that a later command or connect() may change or free
+const char *Fl_Term::reply_str(const char *s, Fl_Term_Pin *out)
 {
-	int l = strlen(sstr);
-	char *p = buff+sel_left;
-	if ( sel_left==sel_right ) p = buff+cursor_x;
-	while ( --p>=buff+l ) {
-		int i;
-		for ( i=l-1; i>=0; i-- )
-			if ( toupper(sstr[i])!=toupper(p[i-l]) ) break;
-		if ( i==-1 ) {
-			sel_left = p-l-buff;
-			sel_right = sel_left+l;
-			while ( line[screen_y]>sel_left ) screen_y--;
-			break;
-		}
-	}
-	if ( p<buff+l ) sel_left = sel_right = 0;
-	redraw();
+	if ( out==NULL ) return s;
+	int len = strlen(s);
+	char *p = (char *)malloc(len+1);
+	if ( p!=NULL ) memcpy(p, s, len);
+	return reply_keep(p, len, out);
 }
 void Fl_Term::learn_prompt()
 {//capture prompt for scripting
@@ -1133,34 +1392,63 @@ void Fl_Term::learn_prompt()
 		sPrompt[0] = buff[cursor_x-2];
 		sPrompt[1] = buff[cursor_x-1];
 		sPrompt[2] = 0;
-		iPrompt = 2;
+		expect_build();
 	}
 }
 int Fl_Term::mark_prompt()
 {
+	expect_mark = cursor_x;		//expect is fed from here on
+	std::lock_guard<std::mutex> lck(prompt_mtx);
 	bPrompt = false;
+	iMatch = -1;
 	return recv0=cursor_x;
 }
 int Fl_Term::waitfor_prompt()
-{
-	int oldlen = recv0;
-	for ( int i=0; i<iTimeOut*10 && !bPrompt; i++ ) {
-		Sleep(100);
-		if ( cursor_x>oldlen ) { i=0; oldlen=cursor_x; }
+{//append() wakes us when sPrompt arrives, time out after iTimeOut seconds
+ //without any new text, so only the time left since text last arrived
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::unique_lock<std::mutex> lck(prompt_mtx);
+	while ( !bPrompt ) {
+		std::chrono::steady_clock::time_point last(
+			std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+				std::chrono::nanoseconds(recv_ns)));
+		if ( last<start ) last = start;
+		last += std::chrono::seconds(iTimeOut);
+		if ( std::chrono::steady_clock::now()>=last ) break;
+		prompt_cv.wait_until(lck, last);
 	}
 	bPrompt = true;
 	return cursor_x - recv0;
 }
-int Fl_Term::command(const char *cmd, const char **preply)
+//commands with a reply share recv0 and the prompt state, so clients of
+//the same terminal take turns, while those of other tabs run in parallel.
+//Commands from the edit line have no reply and never wait here
+int Fl_Term::command(const char *cmd, const char **preply, Fl_Term_Pin *out)
 {
 	int rc = 0;
+	std::unique_lock<std::mutex> lck(cmd_mtx, std::defer_lock);
+	if ( preply!=NULL ) lck.lock();
 	if ( *cmd!='!' ) {
 		if ( live() ) {
 			mark_prompt();
 			send(cmd);
 			send("\r");
 			rc = waitfor_prompt();
-			if ( preply!=NULL ) *preply = buff+recv0;
+			if ( preply!=NULL ) {
+				if ( paged() ) {	//a copy without the pager prompts,
+					//on purpose even with out, prompts can't be cut out of
+					//pinned chunks, so out gets the copy as its only piece
+					char *p = (char *)malloc(rc+1);
+					if ( p!=NULL ) {
+						thaw(recv0, rc);
+						buff.get(p, recv0, rc);
+						rc = pager_strip(p, recv0, rc);
+					}
+					*preply = reply_keep(p, rc, out);
+				}
+				else
+					*preply = reply(recv0, rc, out);
+			}
 		}
 		else {
 			disp(cmd);
@@ -1178,7 +1466,7 @@ int Fl_Term::command(const char *cmd, const char **preply)
 			mark_prompt();
 			logg( p );
 			rc = cursor_x-recv0;
-			if ( preply!=NULL ) *preply = buff+recv0;
+			if ( preply!=NULL ) *preply = reply(recv0, rc, out);
 		}
 		else if ( strncmp(cmd,"Echo",4)==0 ) {
 			bEcho=!bEcho;
@@ -1187,7 +1475,7 @@ int Fl_Term::command(const char *cmd, const char **preply)
 			disp(bEcho?"on":"off");
 			disp("***\033[37m\r\n");
 			rc = cursor_x-recv0;
-			if ( preply!=NULL ) *preply = buff+recv0;
+			if ( preply!=NULL ) *preply = reply(recv0, rc, out);
 		}
 		else if ( strncmp(cmd,"Disp",4)==0 ) {
 			mark_prompt();
@@ -1198,35 +1486,78 @@ int Fl_Term::command(const char *cmd, const char **preply)
 			send(p);
 		}
 		else if ( strncmp(cmd,"Recv",4)==0 ) {
-			if ( preply!=NULL ) *preply = buff+recv0;
 			rc = cursor_x-recv0;
+			if ( preply!=NULL ) *preply = reply(recv0, rc, out);
 			recv0 = cursor_x;
 		}
 		else if ( strncmp(cmd,"Copy",4)==0 ) {
-			Fl::copy(buff, cursor_x, 1);
+			int start = line[line_first];
+			int len = cursor_x-start;
+			char *p = (char *)malloc(len+1);
+			if ( p!=NULL ) {
+				thaw(start, len);
+				buff.get(p, start, len);
+				p[len] = 0;
+				Fl::copy(p, len, 1);
+				free(p);
+			}
 		}
 		else if ( strncmp(cmd,"Hostname",8)==0 ) {
 			if ( preply!=NULL && live() ) {
-				*preply = (char *)host->name();
-				rc = strlen(*preply);
+				rc = strlen(host->name());
+				*preply = reply_str(host->name(), out);
 			}
 		}
 		else if ( strncmp(cmd,"Selection",9)==0) {
-			if ( preply!=NULL ) *preply = buff+sel_left;
 			rc = sel_right-sel_left;
+			if ( preply!=NULL ) *preply = reply(sel_left, rc, out);
 		}
 		else if ( strncmp(cmd,"Timeout",7)==0 ) iTimeOut = atoi(p);
+		else if ( strncmp(cmd,"Stats",5)==0 ) {
+			if ( strncmp(p, "reset", 5)==0 ) stats_reset();
+			else if ( strncmp(p, "on", 2)==0 ) stats_overlay(true);
+			else if ( strncmp(p, "off", 3)==0 ) stats_overlay(false);
+			char *s = (char *)malloc(512);
+			rc = s!=NULL ? stats_text(s, 512) : 0;
+			if ( preply!=NULL ) *preply = reply_keep(s, rc, out);
+			else free(s);
+		}
 		else if ( strncmp(cmd,"Prompt", 6)==0 ) {
 			if ( cmd[6]==' ' ) {
-				strncpy(sPrompt, cmd+7, 31);
-				sPrompt[31] = 0;
+				strncpy(sPrompt, cmd+7, TERM_EXPECT_LEN-1);
+				sPrompt[TERM_EXPECT_LEN-1] = 0;
 				fl_decode_uri(sPrompt);
-				iPrompt = strlen(sPrompt);
+				expect_build();
 			}
 			else 
 				learn_prompt();
-			if ( preply!=NULL ) *preply = sPrompt;
-			rc = iPrompt;
+			if ( preply!=NULL ) *preply = reply_str(sPrompt, out);
+			rc = strlen(sPrompt);
+		}
+		else if ( strncmp(cmd,"Expect", 6)==0 ) {
+			strncpy(sExpect, p, TERM_EXPECT_LEN-1);
+			sExpect[TERM_EXPECT_LEN-1] = 0;
+			fl_decode_uri(sExpect);
+			expect_build();
+			if ( preply!=NULL ) *preply = reply_str(sExpect, out);
+			rc = strlen(sExpect);
+		}
+		else if ( strncmp(cmd,"Pager", 5)==0 ) {
+			strncpy(sPager, p, TERM_EXPECT_LEN-1);
+			sPager[TERM_EXPECT_LEN-1] = 0;
+			fl_decode_uri(sPager);
+			expect_build();
+			if ( preply!=NULL ) *preply = reply_str(sPager, out);
+			rc = strlen(sPager);
+		}
+		else if ( strncmp(cmd,"Matched", 7)==0 ) {
+			char pat[TERM_EXPECT_LEN];
+			matched(pat, sizeof(pat));
+			if ( preply!=NULL ) *preply = reply_str(pat, out);
+			rc = iMatch+1;
+		}
+		else if ( strncmp(cmd,"If ", 3)==0 || strncmp(cmd,"Goto", 4)==0 ) {
+			//only meaningful in scripter()
 		}
 		else if ( strncmp(cmd,"scp",3)==0
 				||strncmp(cmd,"tun",3)==0 
@@ -1234,77 +1565,18 @@ int Fl_Term::command(const char *cmd, const char **preply)
 			mark_prompt();
 			host->command(cmd);
 			if ( preply!=NULL ) {
-				*preply = buff+recv0;
 				rc = waitfor_prompt();
+				*preply = reply(recv0, rc, out);
 			}
 		}
 		else {
 			HOST *host = host_new(cmd);
 			if ( host!=NULL )
-				rc = connect(host, preply);
+				rc = connect(host, preply, out);
 		}
 	}
 	return rc;
 }
-void Fl_Term::put_xml(const char *buf, int len)
-{
-	const char *p=buf, *q;
-	const char spaces[256]="\r\n                                               \
-                                                                              ";
-	if ( strncmp(buf, "<?xml ", 6)==0 ) {
-		xmlIndent = 0;
-		xmlTagIsOpen = true;
-	}
-	while ( *p!=0 && *p!='<' ) p++;
-	if ( p>buf ) append(buf, p-buf);
-	while ( *p!=0 && p<buf+len ) {
-		while (*p==0x0d || *p==0x0a || *p=='\t' || *p==' ') p++;
-		if ( *p==']' && p+6<=buf+len) {//end of message
-			if ( strncmp(p, "]]>]]>", 6)==0 ) {
-				append("]]>]]>\n\033[37m", 12);
-				p+=6;
-			}
-		}
-		else if ( *p=='<' ) { //tag
-			if ( p[1]=='/' ) {
-				if ( !xmlTagIsOpen ) {
-					xmlIndent -= 2;
-					append(spaces, xmlIndent);
-				}
-				xmlTagIsOpen = false;
-			}
-			else {
-				if ( xmlTagIsOpen ) xmlIndent+=2;
-				append(spaces, xmlIndent);
-				xmlTagIsOpen = true;
-			}
-			append("\033[32m",5);
-			q = strchr(p, '>');
-			if ( q==NULL ) q = p+strlen(p);
-			const char *r = strchr(p, ' ');
-			if ( r!=NULL && r<q ) {
-				append(p, r-p);
-				append("\033[34m",5);
-				append(r, q-r);
-			}
-			else
-				append(p, q-p);
-			append("\033[32m>",6);
-			p = q;
-			if ( *q=='>' ) {
-				p++;
-				if ( q[-1]=='/' ) xmlTagIsOpen = false;
-			}
-		}
-		else {		//data
-			append("\033[33m",5);
-			q = strchr(p, '<');
-			if ( q==NULL ) q = p+strlen(p);
-			append(p, q-p);
-			p = q;
-		}
-	}
-}
 void Fl_Term::copier(char *files)
 {
 	bScriptRun = true; bScriptPause = false;
@@ -1342,10 +1614,23 @@ void Fl_Term::copier(char *files)
 	bScriptRun = bScriptPause = false;
 	host->write("\r",1);
 }
+static const char *script_label(const char *cmds, const char *name)
+{//the line after ":name", NULL to end the script if there is none
+	int n = strcspn(name, "\r");
+	for ( const char *p=cmds; p!=NULL; ) {
+		const char *q = strchr(p, 0x0a);
+		if ( *p==':' && strncmp(p+1, name, n)==0 && strchr("\r\n", p[n+1])!=NULL )
+			return q==NULL ? NULL : q+1;
+		p = q==NULL ? NULL : q+1;
+	}
+	return NULL;
+}
 void Fl_Term::scripter(char *cmds)
-{
-	char *p1=cmds, *p0;
+{//lines are copied out, so "!Goto label" can run them again
+	const char *p1=cmds, *p0;
 	const char *reply;
+	char *ln = NULL;
+	int room = 0;
 	bScriptRun = true; bScriptPause = false;
 	while ( bScriptRun && p1!=NULL ) {
 		if ( bScriptPause ) {
@@ -1354,10 +1639,33 @@ void Fl_Term::scripter(char *cmds)
 		else {
 			p0 = p1;
 			p1 = strchr(p0, 0x0a);
-			if ( p1!=NULL ) *p1++ = 0;
-			command(p0, &reply);
+			int n = p1==NULL ? strlen(p0) : p1++-p0;
+			if ( n>=room ) {
+				char *p = (char *)realloc(ln, n+1);
+				if ( p==NULL ) break;
+				ln = p;
+				room = n+1;
+			}
+			memcpy(ln, p0, n);
+			ln[n] = 0;
+			if ( *ln==':' ) continue;		//label
+			if ( strncmp(ln, "!Goto ", 6)==0 )
+				p1 = script_label(cmds, ln+6);
+			else if ( strncmp(ln, "!If ", 4)==0 ) {	//!If pattern label
+				char *label = strrchr(ln+4, ' ');
+				if ( label==NULL ) continue;
+				*label++ = 0;
+				fl_decode_uri(ln+4);
+				char pat[TERM_EXPECT_LEN];
+				matched(pat, sizeof(pat));
+				if ( strcmp(ln+4, pat)==0 )
+					p1 = script_label(cmds, label);
+			}
+			else
+				command(ln, &reply);
 		}
 	}
+	free(ln);
 	free(cmds);
 	bScriptRun = bScriptPause = false;
 }
@@ -1404,66 +1712,3 @@ void Fl_Term::quit_script()
 {
 	bScriptRun = bScriptPause = false;
 }
-
-#define TNO_IAC		0xff
-#define TNO_DONT	0xfe
-#define TNO_DO		0xfd
-#define TNO_WONT	0xfc
-#define TNO_WILL	0xfb
-#define TNO_SUB		0xfa
-#define TNO_SUBEND	0xf0
-#define TNO_ECHO	0x01
-#define TNO_AHEAD	0x03
-#define TNO_STATUS	0x05
-#define TNO_LOGOUT	0x12
-#define TNO_WNDSIZE 0x1f
-#define TNO_TERMTYPE 0x18
-#define TNO_NEWENV	0x27
-unsigned char TERMTYPE[]={//vt100
-	0xff, 0xfa, 0x18, 0x00, 0x76, 0x74, 0x31, 0x30, 0x30, 0xff, 0xf0
-};
-const unsigned char *Fl_Term::telnet_options(const unsigned char *p, int cnt)
-{
-	const unsigned char *q = p+cnt;
-	while ( *p==0xff && p<q ) {
-		unsigned char negoreq[]={0xff,0,0,0, 0xff, 0xf0};
-		switch ( p[1] ) {
-			case TNO_WONT:
-			case TNO_DONT:
-				p+=3;
-				break;
-			case TNO_DO:
-				negoreq[1]=TNO_WONT; negoreq[2]=p[2];
-				if ( p[2]==TNO_TERMTYPE || p[2]==TNO_NEWENV
-					|| p[2]==TNO_ECHO || p[2]==TNO_AHEAD ) {
-					negoreq[1]=TNO_WILL;
-					if ( *p==TNO_ECHO ) bEcho = true;
-				}
-				host->write((const char *)negoreq, 3);
-				p+=3;
-				break;
-			case TNO_WILL:
-				negoreq[1]=TNO_DONT; negoreq[2]=p[2];
-				if ( p[2]==TNO_ECHO || p[2]==TNO_AHEAD ) {
-					negoreq[1]=TNO_DO;
-					if ( p[2]==TNO_ECHO ) bEcho = false;
-				}
-				host->write((const char *)negoreq, 3);
-				p+=3;
-				break;
-			case TNO_SUB:
-				negoreq[1]=TNO_SUB; negoreq[2]=p[2];
-				if ( p[2]==TNO_TERMTYPE ) {
-					host->write((const char *)TERMTYPE, sizeof(TERMTYPE));
-				}
-				if ( p[2]==TNO_NEWENV ) {
-					host->write((const char *)negoreq, 6);
-				}
-				while (*p!=0xff && p<q ) p++;
-				break;
-			case TNO_SUBEND:
-				p+=2;
-		}
-	}
-	return p+1;
-}
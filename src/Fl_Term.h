@@ -17,93 +17,146 @@
 #include <FL/Fl.H>
 #include <FL/fl_draw.H>
 #include "host.h"
-#include <atomic>
-#include <mutex>
+#include "Fl_Term_Core.h"
+#include <regex>
 
 #ifndef _FL_TERM_H_
 #define _FL_TERM_H_
-class Fl_Term : public Fl_Widget {
-	char c_attr;		//current character attribute(color)
-	char save_attr;		//saved character attribute, used with save_x/save_y
-	char *buff;			//buffer for characters, one byte per char
-	char *attr;			//buffer for attributes, one byte per char
-	int buff_size; 		//current buffer size, doubles at more_chars()
-	int *line;			//buffer for starting position of each line
-	int line_size;		//current max number of lines, doubles at more_lines()
-	int size_x; 		//screen width in number of characters
-	int size_y;			//screen height in number of characters
-	int cursor_x;		//index to buff and attr for current insert position
-	int	cursor_y;		//index to line buffer for current row of text
-	int save_x;			//save_x/save_y also used to save and restore cursor
-	int save_y;			//previous cursor_y when switch to alternate screen
-	int screen_y;		//the line at top of screen
-	int roll_top;
-	int roll_bot;		//the range of lines that will scroll in alterscreen
-	int sel_left;
-	int sel_right;		//begin and end of selection in scroll buffer
+
+#define TERM_SAVE_CHUNK	(1<<18)	//bytes copied out per lock() when saving
+#define TERM_REPLAY_STEP	(1<<22)	//bytes of a replayed log between checkpoints
+#define TERM_REPLAY_BACK	(1<<20)	//parsed ahead of a jump, as scrollback
+#define TERM_REPLAY_PAGE	(1<<20)	//bytes a page forward or back in a replay
+#define TERM_FRAME		0.02	//seconds between repaints while text flows
+#define TERM_FLOOD_FRAME	0.1	//between repaints when flooded, echo budget
+#define TERM_FLOOD_RATE	(1<<20)	//bytes/s received when flooded
+#define TERM_STATS_ROWS	5		//lines of the statistics overlay
+
+//emulator state at an offset of a replayed log, kept only where no escape
+//sequence is open. pack holds the length of each screen row, their text,
+//then their attributes, so a jump resumes parsing from the nearest one
+struct Fl_Term_Mark {
+	long long pos;		//file offset the state is at
+	char *pack;
+	int len;			//unpacked size of pack
+	int rows;			//screen rows in pack
+	int cx, cy;			//cursor column and row among them
+	int save_x, save_y;
+	int roll_top, roll_bot;
+	int modes;			//bInsert, bGraphic... as bits
+	char c_attr, save_attr;
+	char tabstops[256];
+};
+
+//the widget draws the core's screen and scroll buffer, and adds the
+//host connection, searching, saving, replaying and scripting on top
+class Fl_Term : public Fl_Widget, public Fl_Term_Core {
+	std::thread srch_worker;	//regular expression search on a snapshot
+	std::atomic<bool> srch_cancel;
+	std::atomic<bool> srch_new;	//srch_found has matches for draw() to take
+	std::mutex srch_mtx;	//guards srch_found
+	int *srch_found;	//matches from srch_worker, in pairs like hits
+	int srch_found_cnt;
+	int srch_found_room;
+	std::thread saver;	//streams the scrollback out to a file
+	std::atomic<int> save_pct;	//progress in percent, -1 when not saving
+	unsigned int save_rgb[16];	//VT_attr colors as RGB, for HTML
+	const char *replay_map;	//log file replayed read-only, NULL if live
+	long long replay_size;
+	std::atomic<long long> replay_pos;	//bytes of it parsed so far
+	long long replay_goal;	//parse up to here, set by replay_keys()
+	int replay_num;		//digits typed before %
+	bool replay_stop;
+	std::mutex replay_mtx;	//guards replay_goal and replay_stop
+	std::condition_variable replay_cv;
+	std::thread replayer;
+	Fl_Term_Mark *marks;	//checkpoints, in file order, marks[0] at 0
+	int mark_cnt;
+	int mark_room;
+	char *reply_buf;	//contiguous copy of text returned to scripts
+	std::mutex cmd_mtx;	//one command with a reply at a time
+	char *row_drawn;	//each row on screen is drawn, and not changed since
+	int drawn_rows;		//number of rows in row_drawn
+	int drawn_y;		//screen_y when last drawn
+	int drawn_cx;		//cursor when last drawn
+	int drawn_cy;
+	bool drawn_cursor;
+	int drawn_sel_l;	//selection when last drawn
+	int drawn_sel_r;
+	bool drawn_bar;		//scrollbar was drawn last time
 	float font_width;	//current font width
+	float ascii_width[128];	//width of each ASCII character in current font
+	float **wide_width;	//widths of other characters, in pages of 256
 	int font_height;	//current font height
 	int font_size;		//current font size, should equal to height
 	int font_face;		//current font face
-	std::atomic<bool> redraw_pending;
-	std::mutex append_mtx;
+	std::chrono::steady_clock::time_point drawn_at;
+	std::atomic<int> flow_bytes;	//received from host since last draw
+	bool flooded;		//skip frames, only draw every TERM_FLOOD_FRAME
+	int throttle_rate;	//bytes/s parsed at most, 0 for no limit
+	double throttle_credit;
+	std::chrono::steady_clock::time_point throttle_at;
+	std::atomic<long long> changed_ns;	//when the first change since draw()
+	std::chrono::steady_clock::time_point stat_at;	//counting since
+	std::atomic<long long> stat_bytes;	//received from this host
+	std::atomic<long long> stat_parse_ns;	//spent parsing them
+	std::atomic<long long> stat_parse_max;	//longest single append()
+	std::atomic<unsigned> stat_queue_max;	//most bytes between reader and parser
+	long long stat_draw_ns;	//spent in draw()
+	long long stat_draw_max;
+	long long stat_lag_max;	//longest from a change to the draw() showing it
+	int stat_draws;
+	int stat_dropped;	//frames due but not drawn, while flooded or busy
 
-	bool bEscape;		//escape sequence processing mode
-	int ESC_idx;		//current index for ESC_code
-	char ESC_code[32];	//cumulating the current escape sequence before process
-	char tabstops[256];
-
-	bool bInsert;		//insert mode, for inline editing for commands
-	bool bGraphic;		//graphic character mode, for text mode drawing
-	bool bCursor;		//display cursor or not
-	bool bAppCursor;	//app cursor mode for vi
-	bool bAltScreen;	//alternative screen for vi
 	bool bScrollbar;	//show scrollbar when true
 	bool bDragSelect;	//mouse dragged to select text, instead of scroll text
-	bool bBracket;		//bracketed paste mode
-	bool bWraparound;
-	bool bOriginMode;
-
-	int bTitle;			//title mode, changed through escape sequence
-	int title_idx;
-	char sTitle[256];	//window title set by host
-
-	char sPrompt[32];	//wait for sPrompt before next command when scripting
-	int iPrompt;		//length of sPrompt
-	bool bPrompt;		//if sPrompt was found after the last append
+	bool bStats;		//draw the statistics overlay
 
 	int iTimeOut;		//time out in seconds while waiting for sPrompt
-	int recv0;			//cursor_x at the start of last command
-	int xmlIndent;		//used by putxml
-	int xmlTagIsOpen;	//used by putxml
 
 	bool bDND;			//if a FL_PASTE is result of drag&drop
 	bool bWait;			//waitfor() function is waiting for string in buffer
-	bool bEcho;			//if local echo is active
 	bool bScriptRun;
 	bool bScriptPause;
 
 	std::atomic<bool> bGets;//gets() function is waiting for return bing pressed
 	std::atomic<bool> bReturn;//true if return has been pressed during gets()
+	std::mutex gets_mtx;	//guards keys and cursor while gets() waits
+	std::condition_variable gets_cv;	//notified by write() on every key
 	int cursor;			//gets receive buffer index
 	char keys[64];		//gets receive buffer
 	bool bPassword;		//if gets() is wating for password, no echo if yes
 
-	char *LogFileName;
-	FILE *fpLogFile;
 	HOST *host;
 
 protected:
 	void draw();
-	void next_line();
-	void buff_clear(int offset, int len);
-	void termsize(int cols, int rows);
-	void screen_clear(int m0);
-	void check_cursor_y();
-	void append( const char *buf, int len );
-	void put_xml(const char *buf, int len);
-	const unsigned char *vt100_Escape(const unsigned char *buf, int cnt);
-	const unsigned char *telnet_options(const unsigned char *buf, int cnt);
+	const char *reply(int from, int len, Fl_Term_Pin *out=NULL);
+	const char *reply_keep(char *p, int len, Fl_Term_Pin *out);
+	const char *reply_str(const char *s, Fl_Term_Pin *out);
+	void govern(int len);
+	bool hit_add(int **p, int *cnt, int *room, int a, int z);
+	void hit_merge();
+	void sel_show();
+	void srch_stop();
+	void srch_regex_worker(std::regex *re, int *lines, int cnt, int base);
+	void save_worker(FILE *fp, int format, char *fn);
+	void replay_worker();
+	void replay_end();
+	void replay_mark();
+	void replay_restore(Fl_Term_Mark *m);
+	void replay_keys(const char *buf, int len);
+	static void scroll_cb(void *data, int X, int Y, int W, int H);
+	void font_metrics();
+	float glyph_width(const char *p, const char *e, int *len);
+	float text_width(const char *p, int n);
+	int row_pos(int y, int px);
+	void stats_draw();
+	void bell();
+	void notify();
+	void answer(const char *buf, int len);
+	void wake();
+	void host_stop(bool drain);
 
 public:
 	Fl_Term(int X,int Y,int W,int H,const char* L=0);
@@ -113,31 +166,43 @@ public:
 	void resize(int X, int Y, int W, int H);
 	void textfont(Fl_Font fontface);
 	void textsize(int fontsize);
-	bool pending(){ return redraw_pending; }
-	void pending(bool p) { redraw_pending=p; }
-	const char *title() { return sTitle; }
+	void lock();
+	void unlock();
+	double since_drawn();
+	double frame_wait();
+	int throttle() { return throttle_rate; }
+	void throttle(int rate) { throttle_rate = rate>0 ? rate : 0; }
+	void stats_reset();
+	int stats_text(char *buf, int size);
+	bool stats_overlay() { return bStats; }
+	void stats_overlay(bool on);
 	const char *hostname() { return host->name(); }
 
-	int sizeX() { return size_x; }
-	int sizeY() { return size_y; }
-	char *logg() { return LogFileName; }
-	void logg(const char *fn);
 	void save(const char *fn);
-	void srch(const char *word);
-
-	int connect(HOST *newhost, const char **preply);
+	int saving() { return save_pct; }
+	int replay(const char *fn);
+	int replaying()		//percent of the log parsed, -1 when not replaying
+	{
+		return replay_map==NULL ? -1 :
+				replay_size>0 ? replay_pos*100/replay_size : 100;
+	}
+	void srch(const char *word, bool back=true);
+	int srch_all(const char *word);
+	int srch_regex(const char *expr);
+	void srch_next(bool back);
+
+	int connect(HOST *newhost, const char **preply, Fl_Term_Pin *out=NULL);
 	bool live() { return host->live(); }
 	void puts(const char *buf, int len);
 	void write(const char *buf, int len);
 	char *gets(const char *prompt, int echo);
 	void disconn();
-	void disp(const char *buf) { append(buf, strlen(buf)); }
 	void send(const char *buf) { write(buf, strlen(buf)); }
 
 	void learn_prompt();
 	int  mark_prompt();
 	int  waitfor_prompt();
-	int command(const char *cmd, const char **preply);
+	int command(const char *cmd, const char **preply, Fl_Term_Pin *out=NULL);
 
 
 	void copier(char *files);
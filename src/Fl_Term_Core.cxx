@@ -0,0 +1,1985 @@
+//
+// Fl_Term_Core -- terminal emulation without a display
+//
+// This library is free software distributed under GNU GPL 3.0,
+// see the license at:
+//
+//     https://github.com/yongchaofan/tinyTerm2/blob/master/LICENSE
+//
+// Please report all bugs and problems on the following page:
+//
+//     https://github.com/yongchaofan/tinyTerm2/issues/new
+//
+#ifdef WIN32
+#include <windows.h>
+#include <io.h>
+#define fsync(fd) _commit(fd)
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define MAX_PATH 4096
+#endif
+#include "Fl_Term_Core.h"
+#ifdef TERM_NO_FLTK		//termbench and termcheck, file names taken as bytes
+#define fl_fopen fopen
+#define fl_access access
+#define fl_rename rename
+#define fl_unlink unlink
+#else
+#include <FL/fl_utf8.h>
+#endif
+#include <limits.h>
+#include <time.h>
+#include <zlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+char *term_pack(const void *src, int len)
+{//zlib at fastest level, scrollback text and attributes compress well
+	uLongf size = compressBound(len);
+	char *pack = (char *)malloc(sizeof(uLongf)+size);
+	if ( pack==NULL ) return NULL;
+	if ( compress2((Bytef *)pack+sizeof(uLongf), &size, (const Bytef *)src,
+						len, Z_BEST_SPEED)!=Z_OK ) {
+		free(pack);
+		return NULL;
+	}
+	memcpy(pack, &size, sizeof(uLongf));
+	char *p = (char *)realloc(pack, sizeof(uLongf)+size);
+	return p!=NULL ? p : pack;
+}
+bool term_unpack(const char *pack, void *dst, int len)
+{
+	uLongf size, out = len;
+	memcpy(&size, pack, sizeof(uLongf));
+	return uncompress((Bytef *)dst, &out, (const Bytef *)pack+sizeof(uLongf),
+						size)==Z_OK && (int)out==len;
+}
+char *term_pack_dup(const char *pack)
+{
+	uLongf size;
+	memcpy(&size, pack, sizeof(uLongf));
+	char *p = (char *)malloc(sizeof(uLongf)+size);
+	if ( p!=NULL ) memcpy(p, pack, sizeof(uLongf)+size);
+	return p;
+}
+const char *term_map(const char *fn, long long *size)
+{//whole file, pages are only read in as the parser gets to them
+	const char *p = NULL;
+#ifdef WIN32
+	HANDLE hFile = CreateFileA(fn, GENERIC_READ, FILE_SHARE_READ|
+					FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 
+					FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if ( hFile==INVALID_HANDLE_VALUE ) return NULL;
+	LARGE_INTEGER li;
+	if ( GetFileSizeEx(hFile, &li) && li.QuadPart>0 ) {
+		HANDLE hMap = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if ( hMap!=NULL ) {		//the view keeps the mapping open
+			p = (const char *)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(hMap);
+		}
+		*size = li.QuadPart;
+	}
+	CloseHandle(hFile);
+#else
+	int fd = open(fn, O_RDONLY);
+	if ( fd==-1 ) return NULL;
+	struct stat sb;
+	if ( fstat(fd, &sb)==0 && sb.st_size>0 ) {
+		void *m = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if ( m!=MAP_FAILED ) {
+			madvise(m, sb.st_size, MADV_SEQUENTIAL);
+			p = (const char *)m;
+		}
+		*size = sb.st_size;
+	}
+	close(fd);
+#endif
+	return p;
+}
+void term_unmap(const char *p, long long size)
+{
+#ifdef WIN32
+	UnmapViewOfFile(p);
+#else
+	munmap((void *)p, size);
+#endif
+}
+void Fl_Term_Attr::slots(int cnt)
+{
+	pos.slots(cnt);
+	val.slots(cnt);
+	first = top = end = 0;
+}
+int Fl_Term_Attr::find(int i)
+{//last run starting at or before position i
+	int lo = first, hi = top-1;
+	while ( lo<hi ) {
+		int mid = (lo+hi+1)/2;
+		if ( pos[mid]<=i ) lo = mid;
+		else hi = mid-1;
+	}
+	return lo;
+}
+int Fl_Term_Attr::run(int &k, int i, char &v)
+{//attribute at position i and where its run ends, k is the run found
+ //last time, so walking a line forward doesn't search for every run
+	if ( i>=end || top==first ) {
+		v = 0;
+		return INT_MAX;
+	}
+	if ( k<first || k>=top || pos[k]>i ) k = find(i);
+	while ( k+1<top && pos[k+1]<=i ) k++;
+	v = pos[k]<=i ? val[k] : 0;
+	int n = k+1<top ? pos[k+1] : end;
+	return n>i ? n : i+1;
+}
+void Fl_Term_Attr::add(int p, char v)
+{//new run at the end, unless it continues the last one
+	if ( top>first && val[top-1]==v ) return;
+	if ( top-first>=pos.span()-1 || !pos.map(top) || !val.map(top) ) return;
+	pos[top] = p;
+	val[top++] = v;
+}
+void Fl_Term_Attr::splice(int k, int cnt, int *at, char *va, int n)
+{//replace cnt runs from run k with n new runs
+	int d = n-cnt;
+	if ( d>0 ) {
+		if ( top+d-first>=pos.span() ) return;
+		for ( int i=top; i<top+d; i++ )
+			if ( !pos.map(i) || !val.map(i) ) return;
+	}
+	pos.move(k+n, k+cnt, top-k-cnt);
+	val.move(k+n, k+cnt, top-k-cnt);
+	for ( int i=0; i<n; i++ ) {
+		pos[k+i] = at[i];
+		val[k+i] = va[i];
+	}
+	top += d;
+}
+void Fl_Term_Attr::fill(int i, char v, int n)
+{
+	int to = i+n;
+	if ( top>first && i<pos[first] ) i = pos[first];
+	if ( i>=to ) return;
+	if ( i>=end ) {				//past the end, the gap reads as 0
+		if ( i>end ) add(end, 0);
+		add(i, v);
+		end = to;
+		return;
+	}
+	int k0 = find(i);			//runs around [i, to) are rebuilt from
+	int k1 = to<end ? find(to) : top-1;	//at most 5 pieces, merging
+	if ( k0>first ) k0--;		//neighbours with the same attribute
+	if ( k1<top-1 ) k1++;
+	int at[6], cnt = 0;
+	char va[6];
+	for ( int k=k0; k<=k1 && pos[k]<i; k++ )
+		if ( cnt==0 || va[cnt-1]!=val[k] ) {
+			at[cnt] = pos[k];
+			va[cnt++] = val[k];
+		}
+	if ( cnt==0 || va[cnt-1]!=v ) {
+		at[cnt] = i;
+		va[cnt++] = v;
+	}
+	for ( int k=k0; k<=k1; k++ ) {
+		int e = k+1<top ? pos[k+1] : end;
+		if ( e>to && (cnt==0 || va[cnt-1]!=val[k]) ) {
+			at[cnt] = pos[k]>to ? pos[k] : to;
+			va[cnt++] = val[k];
+		}
+	}
+	splice(k0, k1-k0+1, at, va, cnt);
+	if ( end<to ) end = to;
+}
+void Fl_Term_Attr::move(int to, int from, int n)
+{//copy the runs out first, as source and destination may overlap
+	int cnt = 0;
+	int k = -1;
+	for ( int i=from; i<from+n; ) {
+		if ( cnt==move_room ) {
+			int room = move_room*2+16;
+			int *p = (int *)realloc(move_at, (room+1)*sizeof(int));
+			if ( p==NULL ) return;
+			move_at = p;
+			char *q = (char *)realloc(move_va, room);
+			if ( q==NULL ) return;
+			move_va = q;
+			move_room = room;
+		}
+		int e = run(k, i, move_va[cnt]);
+		move_at[cnt++] = i;
+		i = e<from+n ? e : from+n;
+	}
+	if ( cnt==0 ) return;
+	move_at[cnt] = from+n;
+	for ( int i=0; i<cnt; i++ )
+		fill(to+move_at[i]-from, move_va[i], move_at[i+1]-move_at[i]);
+}
+void Fl_Term_Attr::trim(int p)
+{//drop runs that end before position p
+	int k = first;
+	while ( k+1<top && pos[k+1]<=p ) k++;
+	for ( int i=first>>TERM_RUNS_BITS; i<k>>TERM_RUNS_BITS; i++ ) {
+		pos.unmap(i<<TERM_RUNS_BITS);
+		val.unmap(i<<TERM_RUNS_BITS);
+	}
+	first = k;
+}
+void Fl_Term_Attr::rebase(int dx)
+{//positions by dx, run indexes by a multiple of span like line[]
+	for ( int k=first; k<top; k++ )
+		pos[k] = pos[k]>dx ? pos[k]-dx : 0;
+	end -= dx;
+	int dk = first>0 ? (first-1)&~(pos.span()-1) : 0;
+	first -= dk;
+	top -= dk;
+}
+static long long log_now()
+{//wall clock in ms, for stamps and the index
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
+static void log_time(char *buf, int size, const char *fmt, long long ms)
+{
+	time_t t = ms/1000;
+	struct tm tm;
+#ifdef WIN32
+	localtime_s(&tm, &t);
+#else
+	localtime_r(&t, &tm);
+#endif
+	strftime(buf, size, fmt, &tm);
+}
+Fl_Term_Log::Fl_Term_Log()
+{
+	fp = ip = NULL;
+	name = NULL;
+	ring = NULL;
+	head = tail = dropped = 0;
+	stamp_head = stamp_tail = 0;
+	on = idle = false;
+	stop = false;
+	sync_secs = 0;
+	stamp = false;
+	rotate_size = rotate_secs = 0;
+	gzip = false;
+}
+Fl_Term_Log::~Fl_Term_Log()
+{
+	close();
+	free(ring);
+}
+bool Fl_Term_Log::open(const char *fn)
+{
+	close();
+	if ( ring==NULL ) ring = (char *)malloc(TERM_LOG_SIZE);
+	if ( ring==NULL ) return false;
+	name = strdup(fn);
+	if ( !file_open() ) {
+		free(name);
+		name = NULL;
+		return false;
+	}
+	head = tail = dropped = 0;
+	stamp_head = stamp_tail = 0;
+	stop = false;
+	std::thread new_writer(&Fl_Term_Log::run, this);
+	writer.swap(new_writer);
+	on = true;
+	return true;
+}
+void Fl_Term_Log::close()
+{//writer drains what is queued before it exits
+	if ( writer.joinable() ) {
+		on = false;
+		mtx.lock();
+		stop = true;
+		mtx.unlock();
+		cv.notify_all();
+		writer.join();
+		file_close(0);
+		free(name);
+		name = NULL;
+	}
+	if ( packer.joinable() ) packer.join();
+}
+bool Fl_Term_Log::file_open()
+{
+	fp = fl_fopen(name, "wb");
+	if ( fp==NULL ) return false;
+	setvbuf(fp, NULL, _IOFBF, 1<<16);
+	char idx[MAX_PATH+8];
+	snprintf(idx, sizeof(idx), "%s.idx", name);
+	ip = fl_fopen(idx, "w");
+	file_ms = log_now();
+	file_size = 0;
+	index_sec = -1;
+	return true;
+}
+void Fl_Term_Log::file_close(long long ms)
+{//when rotating at ms, rename to name.YYYYmmdd-HHMMSS of its start time
+	if ( fp==NULL ) return;
+	fflush(fp);
+	if ( sync_secs>0 ) fsync(fileno(fp));
+	fclose(fp);
+	fp = NULL;
+	if ( ip!=NULL ) fclose(ip);
+	ip = NULL;
+	if ( ms==0 ) return;
+
+	char stamp[32], idx[MAX_PATH+48], *fn = (char *)malloc(MAX_PATH+40);
+	if ( fn==NULL ) return;
+	log_time(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", file_ms);
+	for ( int i=0; ; i++ ) {	//files rotated within a second get -1, -2...
+		int l = snprintf(fn, MAX_PATH+40, "%s.%s", name, stamp);
+		if ( i>0 ) snprintf(fn+l, MAX_PATH+40-l, "-%d", i);
+		snprintf(idx, sizeof(idx), "%s.gz", fn);
+		if ( fl_access(fn, 0)!=0 && fl_access(idx, 0)!=0 ) break;
+	}
+	fl_rename(name, fn);
+	char old_idx[MAX_PATH+8];
+	snprintf(old_idx, sizeof(old_idx), "%s.idx", name);
+	snprintf(idx, sizeof(idx), "%s.idx", fn);
+	fl_rename(old_idx, idx);
+	if ( gzip ) {
+		if ( packer.joinable() ) packer.join();
+		std::thread new_packer(&Fl_Term_Log::pack, fn);
+		packer.swap(new_packer);
+	}
+	else
+		free(fn);
+}
+void Fl_Term_Log::pack(char *fn)
+{//gzip fn to fn.gz, offsets in its index are those of the text unpacked
+	char gz[MAX_PATH+48];
+	snprintf(gz, sizeof(gz), "%s.gz", fn);
+	FILE *in = fl_fopen(fn, "rb");
+	gzFile out = gzopen(gz, "wb");
+	char *buf = (char *)malloc(65536);	//each tab has a packer of its own
+	bool ok = in!=NULL && out!=NULL && buf!=NULL;
+	if ( ok ) {
+		int n;
+		while ( ok && (n=fread(buf, 1, 65536, in))>0 )
+			ok = gzwrite(out, buf, n)==n;
+	}
+	free(buf);
+	if ( in!=NULL ) fclose(in);
+	if ( out!=NULL && gzclose(out)!=Z_OK ) ok = false;
+	fl_unlink(ok ? fn : gz);
+	free(fn);
+}
+void Fl_Term_Log::put_line(const char *p, int n, long long ms)
+{//p is the start of a line, or the rest of one when ms is 0
+	if ( fp==NULL ) {
+		dropped += n;
+		return;
+	}
+	if ( ms!=0 ) {
+		if ( ms/1000!=index_sec ) {
+			index_sec = ms/1000;
+			if ( ip!=NULL ) fprintf(ip, "%lld %lld\n", ms, file_size);
+		}
+		if ( stamp ) {
+			char t[40];
+			log_time(t, sizeof(t), "[%Y-%m-%d %H:%M:%S", ms);
+			int l = strlen(t);
+			l += snprintf(t+l, sizeof(t)-l, ".%03d] ", (int)(ms%1000));
+			fwrite(t, 1, l, fp);
+			file_size += l;
+		}
+	}
+	fwrite(p, 1, n, fp);
+	file_size += n;
+}
+void Fl_Term_Log::write(const char *buf, int len)
+{//called under append_mtx, so there is only one producer at a time
+	unsigned h = head;
+	if ( len<=0 ) return;
+	if ( (unsigned)len>TERM_LOG_SIZE-(h-tail) ) {
+		dropped += len;
+		return;
+	}
+	unsigned sh = stamp_head;	//arrival time, when it changed
+	long long ms = log_now();
+	if ( sh-stamp_tail<TERM_LOG_STAMPS &&
+			(sh==stamp_tail || stamp_ms[(sh-1)%TERM_LOG_STAMPS]!=ms) ) {
+		stamp_pos[sh%TERM_LOG_STAMPS] = h;
+		stamp_ms[sh%TERM_LOG_STAMPS] = ms;
+		stamp_head = sh+1;
+	}
+	unsigned i = h&(TERM_LOG_SIZE-1);
+	unsigned n = (unsigned)len<TERM_LOG_SIZE-i ? len : TERM_LOG_SIZE-i;
+	memcpy(ring+i, buf, n);
+	memcpy(ring, buf+n, len-n);
+	head = h+len;
+	if ( idle ) {
+		std::lock_guard<std::mutex> lck(mtx);
+		cv.notify_all();
+	}
+}
+void Fl_Term_Log::run()
+{
+	std::chrono::steady_clock::time_point synced = std::chrono::steady_clock::now();
+	bool bol = true;			//next byte starts a line
+	long long ms = log_now();	//arrival time of the byte at tail
+	for ( ;; ) {
+		unsigned t = tail;
+		unsigned n = head-t;
+		if ( n>0 ) {				//everything up to the wrap in one pass
+			unsigned i = t&(TERM_LOG_SIZE-1);
+			if ( n>TERM_LOG_SIZE-i ) n = TERM_LOG_SIZE-i;
+			const char *p = ring+i, *zz = p+n;
+			while ( p<zz ) {
+				unsigned pos = t+(p-(ring+i));
+				unsigned st = stamp_tail;
+				while ( st!=stamp_head && (int)(stamp_pos[st%TERM_LOG_STAMPS]-pos)<=0 ) {
+					ms = stamp_ms[st%TERM_LOG_STAMPS];
+					stamp_tail = ++st;
+				}
+				if ( bol && ((rotate_size>0 && file_size>=rotate_size) ||
+						(rotate_secs>0 && ms-file_ms>=rotate_secs*1000LL)) ) {
+					file_close(ms);
+					file_open();	//if it fails, put_line() counts drops
+				}
+				const char *q = (const char *)memchr(p, '\n', zz-p);
+				const char *e = q!=NULL ? q+1 : zz;
+				put_line(p, e-p, bol ? ms : 0);
+				bol = q!=NULL;
+				p = e;
+			}
+			tail = t+n;
+			if ( head!=tail ) continue;
+			if ( fp!=NULL ) fflush(fp);
+			if ( ip!=NULL ) fflush(ip);
+		}
+		if ( fp!=NULL && sync_secs>0 && std::chrono::steady_clock::now()-synced>=
+								std::chrono::seconds(sync_secs) ) {
+			fflush(fp);
+			fsync(fileno(fp));
+			synced = std::chrono::steady_clock::now();
+		}
+		std::unique_lock<std::mutex> lck(mtx);
+		if ( head!=tail ) continue;
+		if ( stop ) break;
+		idle = true;
+		if ( sync_secs>0 )
+			cv.wait_for(lck, std::chrono::seconds(sync_secs),
+						[this]{ return head!=tail || stop; });
+		else
+			cv.wait(lck, [this]{ return head!=tail || stop; });
+		idle = false;
+	}
+}
+Fl_Term_Expect::Fl_Term_Expect()
+{
+	used = cnt = lost = ncls = state = 0;
+	prompts = pagers = 0;
+	next = NULL;
+	out = NULL;
+	build();
+}
+unsigned Fl_Term_Expect::add(const char *list)
+{
+	unsigned bits = 0;
+	for ( const char *p=list; p!=NULL; ) {
+		const char *q = strchr(p, '|');
+		int n = q==NULL ? strlen(p) : q-p;
+		if ( n==0 ) ;		//empty, would match at every byte
+		else if ( cnt<TERM_EXPECT_MAX && used+n<(int)sizeof(text) ) {
+			bits |= 1u<<cnt;
+			at[cnt++] = used;
+			memcpy(text+used, p, n);
+			used += n;
+			text[used++] = 0;
+		}
+		else
+			lost++;
+		p = q==NULL ? NULL : q+1;
+	}
+	return bits;
+}
+void Fl_Term_Expect::build()
+{
+	free(next);
+	free(out);
+	memset(cls, 0, sizeof(cls));
+	ncls = 1;
+	for ( int i=0; i<used; i++ ) {
+		unsigned char c = text[i];
+		if ( c!=0 && cls[c]==0 ) cls[c] = ncls++;
+	}
+	int size = used-cnt+1;	//root and a state for each pattern byte
+	next = (short *)calloc(size*ncls, sizeof(short));
+	out = (unsigned *)calloc(size, sizeof(unsigned));
+	short *fail = (short *)calloc(size, sizeof(short));
+	short *queue = (short *)malloc(size*sizeof(short));
+	if ( next==NULL || out==NULL || fail==NULL || queue==NULL ) {
+		free(next); next = NULL;
+		free(out); out = NULL;
+		free(fail);
+		free(queue);
+		return;
+	}
+
+	int states = 1;			//the trie, 0 means no child yet
+	for ( int i=0; i<cnt; i++ ) {
+		int s = 0;
+		for ( const unsigned char *p=(const unsigned char *)text+at[i]; *p; p++ ) {
+			short &t = next[s*ncls+cls[*p]];
+			if ( t==0 ) t = states++;
+			s = t;
+		}
+		out[s] |= 1u<<i;
+	}
+	int head = 0, tail = 0;	//then breadth first, a missing child becomes
+	queue[tail++] = 0;		//the transition of the longest proper suffix
+	while ( head<tail ) {
+		int s = queue[head++];
+		out[s] |= out[fail[s]];
+		for ( int c=0; c<ncls; c++ ) {
+			short &t = next[s*ncls+c];
+			int f = s==0 ? 0 : next[fail[s]*ncls+c];
+			if ( t!=0 ) {
+				fail[t] = f;
+				queue[tail++] = t;
+			}
+			else
+				t = f;
+		}
+	}
+	free(fail);
+	free(queue);
+	state = 0;
+}
+Fl_Term_Core::Fl_Term_Core(int cols, int rows)
+{
+	bEcho = false;
+	*sTitle = 0;
+	strcpy(sPrompt, "> ");
+	*sExpect = 0;
+	*sPager = 0;
+	pager_hits = NULL;
+	pager_cnt = pager_room = 0;
+	expect_mark = -1;
+	recv_ns = 0;
+	expect_build();
+	LogFileName = NULL;
+	grams = NULL;
+	gram_mask = -1;
+	hits = NULL;
+	hit_cnt = hit_room = 0;
+	srch_shift = 0;
+	save_line = save_last = 0;
+	redraw_pending = false;
+	for ( int i=0; i<TERM_DIRTY_ROWS/32; i++ ) {
+		row_touched[i] = 0;
+		row_dirty[i] = 0;
+	}
+	touched = false;
+	touch_y = 0;
+
+	size_x = cols;
+	size_y = rows;
+	scroll_lines = 65536;
+	clear();
+	roll_top = 0;
+	roll_bot = size_y-1;
+}
+Fl_Term_Core::~Fl_Term_Core()
+{
+	for ( int i=0; i<=gram_mask; i++ ) free(grams[i]);
+	free(grams);
+	free(hits);
+	free(pager_hits);
+}
+void Fl_Term_Core::clear()
+{
+	lock();
+	append_mtx.lock();
+	reset();
+	append_mtx.unlock();
+	unlock();
+	pending(true);
+}
+void Fl_Term_Core::reset()
+{
+	//64 characters per line like before, plus 2 for cursor, plus 2 let go
+	//of by more_room() but not freed by reclaim() yet
+	int chunks = 4;
+	while ( chunks<((scroll_lines*64)>>TERM_CHUNK_BITS)+4 ) chunks*=2;
+	buff.slots(chunks);
+	for ( int i=0; i<=gram_mask; i++ ) free(grams[i]);
+	free(grams);
+	grams = (unsigned char **)calloc(chunks, sizeof(unsigned char *));
+	gram_mask = grams!=NULL ? chunks-1 : -1;
+	hit_cnt = 0;
+	attr.slots(chunks<<(TERM_CHUNK_BITS-TERM_RUNS_BITS));
+	int lines = 4;	//scrollback plus screen, plus 2 spare chunks and a slice
+	while ( lines<((scroll_lines+1024+TERM_APPEND_SLICE)>>TERM_LINES_BITS)+3 )
+		lines*=2;
+	line.slots(lines);
+	line_first = line_freed = 0;
+	buff_first = buff_freed = buff_top = buff_cold = 0;
+	bReclaim = false;
+	line_top = -1;
+	thaw_low = INT_MAX;
+	cursor_y = cursor_x = 0;
+	screen_y = 0;
+	sel_left = sel_right= 0;
+	c_attr = 7;//default black background, white foreground
+	recv0 = expect_pos = 0;
+	ESC_idx = ESC_state = 0;
+	bInsert = bEscape = bGraphic = bTitle = false;
+	bBracket = bAltScreen = bAppCursor = bOriginMode = false;
+	bWraparound = true;
+	bCursor = true;
+	prompt_found(-1);
+	memset(tabstops, 0, 256);
+	for ( int i=0; i<256; i+=8 ) tabstops[i]=1;
+
+	xmlIndent=0;
+	xmlTagIsOpen=true;
+	more_room();
+	for ( int i=0; i<TERM_DIRTY_ROWS/32; i++ ) {
+		row_touched[i] = 0;
+		row_dirty[i] = ~0u;		//every row is new
+	}
+	touched = false;
+	touch_y = 0;
+}
+int Fl_Term_Core::pin(int from, int len, Fl_Term_Pin *out)
+{//[from, from+len) as pieces of the chunks, returns the bytes pinned
+	out->cnt = out->size = 0;
+	out->chunk = out->text = NULL;
+	out->len = NULL;
+	out->copy = NULL;
+	lock();
+	if ( from<buff_first ) {		//scrolled out already
+		len -= buff_first-from;
+		from = buff_first;
+	}
+	if ( len>buff_top-from ) len = buff_top-from;
+	int top = cursor_y-size_y+1;	//rows the host can still write to
+	if ( top>screen_y ) top = screen_y;
+	if ( top<line_first ) top = line_first;
+	int keep = line[top]-from;		//bytes that are pinned, the rest copied
+	if ( keep<0 ) keep = 0;
+	if ( keep>len ) keep = len;
+	if ( len>0 ) {
+		int n = ((from+len-1)>>TERM_CHUNK_BITS)-(from>>TERM_CHUNK_BITS)+2;
+		out->chunk = (const char **)malloc(n*sizeof(char *));
+		out->text = (const char **)malloc(n*sizeof(char *));
+		out->len = (int *)malloc(n*sizeof(int));
+		if ( keep<len ) out->copy = (char *)malloc(len-keep);
+		if ( out->chunk!=NULL && out->text!=NULL && out->len!=NULL &&
+			(keep==len || out->copy!=NULL) ) {
+			thaw(from, len);
+			while ( out->size<keep ) {
+				int i = from+out->size;
+				const char *c = buff.pin(i);
+				if ( c==NULL ) break;	//could not be thawed
+				int l = buff.run(i, keep-out->size);
+				out->chunk[out->cnt] = c;
+				out->text[out->cnt] = c+(i&((1<<TERM_CHUNK_BITS)-1));
+				out->len[out->cnt++] = l;
+				out->size += l;
+			}
+			if ( out->size==keep && keep<len ) {
+				buff.get(out->copy, from+keep, len-keep);
+				out->chunk[out->cnt] = NULL;
+				out->text[out->cnt] = out->copy;
+				out->len[out->cnt++] = len-keep;
+				out->size = len;
+			}
+		}
+	}
+	unlock();
+	return out->size;
+}
+void term_unpin(Fl_Term_Pin *pin)
+{
+	for ( int i=0; i<pin->cnt; i++ )
+		if ( pin->chunk[i]!=NULL )
+			Fl_Term_Ring<char, TERM_CHUNK_BITS>::unref(pin->chunk[i]);
+	free(pin->chunk);
+	free(pin->text);
+	free(pin->len);
+	free(pin->copy);
+	pin->cnt = 0;
+	pin->size = -1;
+	pin->chunk = pin->text = NULL;
+	pin->len = NULL;
+	pin->copy = NULL;
+}
+//a malloc'ed copy handed out as the only piece, freed by term_unpin()
+void term_pin_own(Fl_Term_Pin *pin, char *text, int len)
+{
+	pin->cnt = 0;
+	pin->size = -1;
+	pin->chunk = (const char **)malloc(sizeof(char *));
+	pin->text = (const char **)malloc(sizeof(char *));
+	pin->len = (int *)malloc(sizeof(int));
+	pin->copy = text;
+	if ( pin->chunk!=NULL && pin->text!=NULL && pin->len!=NULL &&
+		text!=NULL ) {
+		pin->chunk[0] = NULL;
+		pin->text[0] = text;
+		pin->len[0] = len;
+		pin->cnt = 1;
+		pin->size = len;
+	}
+}
+void Fl_Term_Core::scrollback(int lines)
+{
+	if ( lines<1024 ) lines = 1024;
+	if ( lines>(1<<22) ) lines = 1<<22;
+	scroll_lines = lines;
+	clear();
+}
+void Fl_Term_Core::next_line()
+{
+	line[++cursor_y]=cursor_x;
+	if ( screen_y==cursor_y-size_y ) screen_y++;
+	if ( line[cursor_y+1]<cursor_x ) line[cursor_y+1]=cursor_x;
+	touch_rows(cursor_y-1, 2);
+	more_room();
+}
+//rows showing any of buff from..from+len, most often just the cursor row,
+//else found by walking from the row found last time, as clears and copies
+//of more rows mostly go row by row
+void Fl_Term_Core::touch_span(int from, int len)
+{
+	if ( from>=line[cursor_y] && from+len<=line[cursor_y+1] ) {
+		touch(cursor_y);
+		return;
+	}
+	int lo = line_first, hi = line_top-1;
+	int y = touch_y;
+	if ( y<lo || y>=hi ) y = cursor_y;
+	while ( y>lo && line[y]>from ) y--;
+	while ( y<hi && line[y+1]<=from && line[y+1]>=line[y] ) y++;
+	touch_y = y;
+	for ( ; y<hi && line[y]<from+len; y++ ) {
+		if ( line[y+1]>from ) touch(y);
+		if ( line[y+1]<line[y] ) break;	//rows below are not laid out yet
+	}
+}
+//rows are marked dirty for the view only after the slice changed them, so
+//a row it takes the bit of and draws meanwhile is drawn again next frame
+void Fl_Term_Core::touch_flush()
+{
+	if ( !touched ) return;
+	touched = false;
+	for ( int i=0; i<TERM_DIRTY_ROWS/32; i++ ) {
+		if ( row_touched[i]==0 ) continue;
+		row_dirty[i] |= row_touched[i];
+		row_touched[i] = 0;
+	}
+}
+//map chunks for current line and the screen below it, let go of the oldest
+//chunk when scrollback is full, neither one copies any text already in the
+//buffer. Runs with append_mtx held and never takes lock(), the view may still
+//read what is let go of until reclaim() frees it
+void Fl_Term_Core::more_room()
+{
+	while ( line_top<cursor_y+size_y+4 ) {
+		if ( !line.map(++line_top) ) break;
+		line[line_top] = 0;
+	}
+	int keep = ((scroll_lines*64)>>TERM_CHUNK_BITS)+2;
+	while ( buff_top<=cursor_x+TERM_LINE_ROOM ) {
+		if ( buff_top-buff_first>=(keep<<TERM_CHUNK_BITS) )
+			buff_first += 1<<TERM_CHUNK_BITS;
+		if ( buff_top-buff_freed>=buff.span() || !buff.map(buff_top) ) break;
+		buff_top += 1<<TERM_CHUNK_BITS;
+	}
+
+	int first = line_first;
+	if ( first<cursor_y-scroll_lines ) first = cursor_y-scroll_lines;
+	while ( first<cursor_y && line[first]<buff_first ) first++;
+	if ( first>line_first ) {
+		line_first = first;
+		if ( recv0<buff_first ) recv0 = line[first];
+	}
+
+	int hot = screen_y<cursor_y-size_y ? screen_y : cursor_y-size_y;
+	hot -= size_y*TERM_HOT_PAGES;
+	int cold = hot>line_first ? line[hot]&~((1<<TERM_CHUNK_BITS)-1) : 0;
+	if ( buff_freed<buff_first
+		|| (line_first>>TERM_LINES_BITS)>(line_freed>>TERM_LINES_BITS)
+		|| buff_cold<cold || thaw_low<cold
+		|| cursor_x>(1<<30) || cursor_y>(1<<30) ) bReclaim = true;
+}
+//free the chunks more_room() let go of, and freeze those out of view,
+//called with both lock() and append_mtx held
+void Fl_Term_Core::reclaim()
+{
+	bReclaim = false;
+	while ( buff_freed<buff_first ) {
+		buff.unmap(buff_freed);
+		if ( gram_mask>=0 ) {
+			int k = (buff_freed>>TERM_CHUNK_BITS)&gram_mask;
+			free(grams[k]);
+			grams[k] = NULL;
+		}
+		buff_freed += 1<<TERM_CHUNK_BITS;
+	}
+	attr.trim(buff_first);
+	if ( buff_cold<buff_first ) buff_cold = buff_first;
+	int first = line_first&~((1<<TERM_LINES_BITS)-1);	//whole chunks only
+	for ( ; line_freed<first; line_freed+=1<<TERM_LINES_BITS )
+		line.unmap(line_freed);
+	if ( screen_y<line_first ) screen_y = line_first;
+	if ( sel_left<buff_first || sel_right<buff_first )
+		sel_left = sel_right = 0;
+
+	//freeze chunks a few pages above both the screen and the cursor,
+	//and those thawed by draw() or srch() once they are out of view again
+	int hot = screen_y<cursor_y-size_y ? screen_y : cursor_y-size_y;
+	hot -= size_y*TERM_HOT_PAGES;
+	if ( hot>line_first ) {
+		int cold = line[hot]&~((1<<TERM_CHUNK_BITS)-1);
+		if ( buff_cold<cold || thaw_low<cold ) {
+			int low = thaw_low<buff_cold ? thaw_low : buff_cold;
+			if ( low<buff_first ) low = buff_first;
+			thaw_low = INT_MAX;
+			for ( int i=low; i<buff_top; i+=1<<TERM_CHUNK_BITS ) {
+				if ( i<cold ) {
+					gram_build(i);
+					buff.freeze(i);
+				}
+				else if ( i<buff_cold && buff.mapped(i) ) {
+					if ( thaw_low>i ) thaw_low = i;
+				}
+				else if ( i>=buff_cold ) break;
+			}
+			if ( buff_cold<cold ) buff_cold = cold;
+		}
+	}
+
+	if ( cursor_x>(1<<30) || cursor_y>(1<<30) ) {//rebase before int overflow
+		//multiples of span, so chunks stay in their slots
+		int dx = buff_first>0 ? (buff_first-1)&~(buff.span()-1) : 0;
+		int dy = line_first>0 ? (line_first-1)&~(line.span()-1) : 0;
+		if ( dx>0 ) for ( int i=line_first; i<=line_top; i++ )
+			if ( line[i]>dx ) line[i]-=dx;
+		cursor_x -= dx; buff_first -= dx; buff_top -= dx; buff_cold -= dx;
+		buff_freed -= dx;
+		attr.rebase(dx);
+		for ( int i=0; i<hit_cnt*2; i++ ) hits[i] -= dx;
+		srch_shift += dx;
+		if ( thaw_low<INT_MAX ) thaw_low -= dx;
+		recv0 = recv0>dx ? recv0-dx : line[line_first];
+		expect_pos = expect_pos>dx ? expect_pos-dx : line[line_first];
+		expect_mtx.lock();
+		for ( int i=0; i<pager_cnt; i++ ) {
+			pager_hits[i*3] -= dx;
+			pager_hits[i*3+2] -= dx;
+		}
+		expect_mtx.unlock();
+		if ( sel_left>dx && sel_right>dx ) {
+			sel_left -= dx; sel_right -= dx;
+		}
+		else
+			sel_left = sel_right = 0;
+		cursor_y -= dy; screen_y -= dy; line_first -= dy; line_top -= dy;
+		line_freed -= dy;
+		save_line -= dy; save_last -= dy;
+	}
+}
+//copy of the chunk holding i for the regex worker, i is a position from
+//before any rebase since srch_shift was reset. No lock() is taken, so
+//srch_stop() can join the worker while holding it, and frozen chunks are
+//unpacked into dst by the worker instead of being thawed in place
+bool Fl_Term_Core::srch_chunk(int i, char *dst)
+{
+	if ( i-srch_shift<buff_first || !buff.copy(i, dst) ) return false;
+	return i-srch_shift>=buff_first;	//its slot has not been reused yet
+}
+//decompress frozen chunks in [from, from+len) before reading them
+void Fl_Term_Core::thaw(int from, int len)
+{
+	lock();
+	int to = from+len;
+	if ( from<buff_first ) from = buff_first;
+	if ( to>buff_cold ) to = buff_cold;
+	for ( int i=from&~((1<<TERM_CHUNK_BITS)-1); i<to; i+=1<<TERM_CHUNK_BITS )
+		if ( buff.frozen(i) && buff.thaw(i) && thaw_low>i ) thaw_low = i;
+	unlock();
+}
+//length of the run of printable ASCII at p, stops at control bytes, ESC,
+//0xff and any UTF-8 byte, all of which need the byte by byte path
+static int ascii_run(const unsigned char *p, int len)
+{
+	int i = 0;
+#ifdef __SSE2__
+	const __m128i space = _mm_set1_epi8(0x1f);	//signed compare, so 0x80
+	for ( ; i+16<=len; i+=16 ) {				//and above fail as well
+		__m128i v = _mm_loadu_si128((const __m128i *)(p+i));
+		int mask = _mm_movemask_epi8(_mm_cmpgt_epi8(v, space))^0xffff;
+		if ( mask!=0 ) return i+__builtin_ctz(mask);
+	}
+#endif
+	while ( i<len && p[i]>=0x20 && p[i]<0x80 ) i++;
+	return i;
+}
+void Fl_Term_Core::prompt_found(int match)
+{//wake waitfor_prompt() now instead of at its next poll
+	{
+		std::lock_guard<std::mutex> lck(prompt_mtx);
+		bPrompt = true;
+		iMatch = match;
+	}
+	prompt_cv.notify_all();
+}
+void Fl_Term_Core::expect_build()
+{//recompile sPrompt, sExpect and sPager, tell about patterns left out
+	int lost;
+	{
+		std::lock_guard<std::mutex> lck(expect_mtx);
+		expect.clear();
+		expect.prompts = expect.add(sPrompt);
+		if ( *sExpect ) expect.add(sExpect);
+		if ( *sPager ) expect.pagers = expect.add(sPager);
+		expect.build();
+		lost = expect.dropped();
+	}
+	if ( lost>0 ) {		//after expect_mtx, append() takes it
+		char msg[80];
+		snprintf(msg, sizeof(msg), "\r\n\033[31m***%d patterns over %d "
+					"ignored***\033[37m\r\n", lost, TERM_EXPECT_MAX);
+		disp(msg);
+	}
+}
+void Fl_Term_Core::matched(char *buf, int size)
+{//copy of the pattern that ended the last wait, a script may rebuild expect
+	std::lock_guard<std::mutex> lck(expect_mtx);
+	strncpy(buf, expect.pattern(iMatch), size-1);
+	buf[size-1] = 0;
+}
+static int lowest_bit(unsigned m)
+{
+	int i = 0;
+	while ( (m&1)==0 ) { m >>= 1; i++; }
+	return i;
+}
+void Fl_Term_Core::pager_hit(int match)
+{//page on right away, and remember where for pager_strip()
+	if ( pager_cnt==pager_room ) {
+		int n = pager_room*2+16;
+		int *p = (int *)realloc(pager_hits, n*3*sizeof(int));
+		if ( p==NULL ) return;
+		pager_hits = p;
+		pager_room = n;
+	}
+	int a = expect_pos-strlen(expect.pattern(match));
+	int y = cursor_y;
+	while ( y>line_first && line[y]>a ) y--;
+	pager_hits[pager_cnt*3] = a;
+	pager_hits[pager_cnt*3+1] = match;
+	pager_hits[pager_cnt*3+2] = line[y];	//the row, even if erased later
+	pager_cnt++;
+	answer(" ", 1);
+}
+bool Fl_Term_Core::paged()
+{
+	std::lock_guard<std::mutex> lck(expect_mtx);
+	return pager_cnt>0;
+}
+int Fl_Term_Core::pager_strip(char *p, int from, int len)
+{//p holds len bytes of buff from 'from', take out the pager prompts still
+ //there and the blanks at the end of their rows. Rows left with nothing
+ //else go too, also where the host erased the prompt with blanks
+	std::lock_guard<std::mutex> lck(expect_mtx);
+	int r = 0, w = 0;
+	for ( int k=0; k<pager_cnt; k++ ) {
+		const char *pat = expect.pattern(pager_hits[k*3+1]);
+		int a = pager_hits[k*3]-from;
+		int n = strlen(pat);
+		int s = pager_hits[k*3+2]-from;
+		if ( s<r || s>=len ) continue;	//row done for an earlier prompt
+		int e = s;
+		while ( e<len && p[e]!=0x0a ) e++;
+		memmove(p+w, p+r, s-r);
+		w += s-r;
+		int w0 = w;
+		if ( a>=s && a+n<=e && memcmp(p+a, pat, n)==0 ) {
+			memmove(p+w, p+s, a-s);
+			w += a-s;
+			s = a+n;
+		}
+		memmove(p+w, p+s, e-s);	//rest of the row, or what overwrote it
+		w += e-s;
+		r = e;
+		while ( w>w0 && p[w-1]==' ' ) w--;
+		if ( w==w0 && r<len ) r++;	//nothing else in the row
+	}
+	memmove(p+w, p+r, len-r);
+	return w+len-r;
+}
+void Fl_Term_Core::expect_scan()
+{//feed only what was appended since the last scan, if the host moved the
+ //cursor back to rewrite text, start over from the cursor
+	std::lock_guard<std::mutex> lck(expect_mtx);
+	if ( !expect.ready() ) return;
+	int mark = expect_mark.exchange(-1);
+	if ( mark>=0 ) {			//a new wait, from where mark_prompt() was
+		expect.reset();
+		expect_pos = mark;
+		pager_cnt = 0;
+	}
+	if ( expect_pos<buff_first || expect_pos>cursor_x ) {
+		expect.reset();
+		expect_pos = expect_pos<buff_first ? (int)buff_first : cursor_x;
+	}
+	unsigned others = ~expect.prompts;
+	while ( expect_pos<cursor_x ) {
+		unsigned m = expect.step(buff[expect_pos++])&others;
+		if ( m&expect.pagers ) {
+			pager_hit(lowest_bit(m&expect.pagers));
+			m &= ~expect.pagers;
+		}
+		if ( m!=0 ) {
+			expect_pos = cursor_x;
+			prompt_found(lowest_bit(m));
+			return;
+		}
+	}
+	unsigned m = expect.found()&expect.prompts;
+	if ( m!=0 ) prompt_found(lowest_bit(m));
+}
+//parsed in slices, between them reclaim() frees what scrolled out. It needs
+//lock() as well, taken before append_mtx like the view does when it echoes
+void Fl_Term_Core::append( const char *newtext, int len )
+{
+	const unsigned char *p = (const unsigned char *)newtext;
+	const unsigned char *zz = p+len;
+	while ( p<zz ) {
+		const unsigned char *e = zz-p>TERM_APPEND_SLICE ? p+TERM_APPEND_SLICE : zz;
+		append_mtx.lock();	//only one thread can append to buffer at a time
+		append_slice(p, e);
+		bool more = bReclaim;
+		append_mtx.unlock();
+		if ( more ) {
+			lock();
+			append_mtx.lock();
+			reclaim();
+			append_mtx.unlock();
+			unlock();
+		}
+		p = e;
+	}
+	recv_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+void Fl_Term_Core::append_slice(const unsigned char *p, const unsigned char *zz)
+{
+	if ( logger.active() ) logger.write((const char *)p, zz-p);
+	if ( bEscape ) p = vt100_Escape( p, zz-p );
+	while ( p < zz ) {
+		if ( *p>=0x20 && *p<0x80 && !bTitle && !bGraphic && !bInsert ) {
+			int room = size_x-(cursor_x-line[cursor_y]);
+			if ( room>0 ) {	//copy printable ASCII up to the end of row,
+				int n = zz-p;	//no wrap check is needed before that
+				n = ascii_run(p, n<room ? n : room);
+				buff.put(cursor_x, (const char *)p, n);
+				attr.fill(cursor_x, c_attr, n);
+				cursor_x += n;
+				p += n;
+				if ( line[cursor_y+1]<cursor_x )
+					line[cursor_y+1]=cursor_x;
+				touch(cursor_y);
+				continue;
+			}
+		}
+		unsigned char c=*p++;
+		if ( bTitle ) {
+			if ( c==0x07 ) {
+				bTitle = false;
+				sTitle[title_idx]=0;
+				notify();
+			}
+			else {
+				if ( title_idx<128 ) sTitle[title_idx++] = c;
+			}
+			continue;
+		}
+		switch ( c ) {
+			case 0x00:
+			case 0x0e:
+			case 0x0f:	break;
+			case 0x07:	bell(); break;
+			case 0x08:
+				if ( cursor_x>line[cursor_y] ) {
+					if ( (buff[cursor_x--]&0xc0)==0x80 )//utf8 continuation byte
+						while ( (buff[cursor_x]&0xc0)==0x80 )
+							cursor_x--;
+				}
+				break;
+			case 0x09:{
+				int l;
+				do {
+					attr.set(cursor_x, c_attr);
+					buff[cursor_x++]=' ';
+				 	l=cursor_x-line[cursor_y];
+				} while ( l<=size_x && tabstops[l]==0 );
+				touch(cursor_y);
+			}
+					break;
+			case 0x0a:
+			case 0x0b:
+			case 0x0c:
+				if ( bAltScreen || line[cursor_y+2]!=0 ) { //IND to next line
+						vt100_Escape((unsigned char *)"D", 1);
+				}
+				else {	//LF and newline
+					cursor_x = line[cursor_y+1]	;
+					attr.set(cursor_x, c_attr);
+					buff[cursor_x++] = 0x0a;
+					next_line();		//touches the row ended too
+				}
+				break;
+			case 0x0d:
+				if ( cursor_x-line[cursor_y]==size_x+1 && *p!=0x0a )
+					next_line();//soft line feed
+				else
+					cursor_x = line[cursor_y];
+				break;
+			case 0x1b:
+				p = vt100_Escape(p, zz-p);
+				break;
+			case 0xff:
+				p = telnet_options(p-1, zz-p+1);
+				break;
+		case 0xe2:
+			if ( bAltScreen ) {//utf8 box drawing hack
+				c = ' ';
+				if ( *p++==0x94 ) {
+					switch ( *p ) {
+						case 0x80:
+						case 0xac:
+						case 0xb4:
+						case 0xbc: c='_'; break;
+						case 0x82:
+						case 0x94:
+						case 0x98:
+						case 0x9c:
+						case 0xa4: c='|'; break;
+						}
+					}
+					p++;
+				}//fall through
+		default:
+			if ( bGraphic ) {
+				switch ( c ){//charset 2 box drawing
+					case 'q': c='_'; break;
+					case 'x': c='|';
+					case 't':
+					case 'u':
+					case 'm':
+					case 'j': c='|'; break;
+					case 'l':
+					case 'k': c=' '; break;
+					default: c = '?';
+				}
+			}
+			if ( bInsert )		//insert one space
+				vt100_Escape((unsigned char *)"[1@",3);
+			if ( cursor_x-line[cursor_y]>=size_x ) {
+				int char_cnt = 0;
+				for ( int i=line[cursor_y]; i<cursor_x; i++ )
+					if ( (buff[i]&0xc0)!=0x80 ) char_cnt++;
+				if ( char_cnt==size_x ) {
+					if ( bWraparound  )
+					next_line();
+					else
+						cursor_x--;
+				}
+			}
+			attr.set(cursor_x, c_attr);
+			buff[cursor_x++] = c;
+			if ( line[cursor_y+1]<cursor_x )
+				line[cursor_y+1]=cursor_x;
+			touch(cursor_y);
+		}
+	}
+	touch_flush();
+	if ( !bPrompt ) expect_scan();
+	pending(true);
+}
+void Fl_Term_Core::buff_clear(int offset, int len)
+{
+	buff.fill(offset, ' ', len);
+	attr.fill(offset,   7, len);
+	touch_span(offset, len);
+}
+void Fl_Term_Core::buff_copy(int to, int from, int len)
+{
+	buff.move(to, from, len);
+	attr.move(to, from, len);
+	touch_span(to, len);
+}
+/*[2J, mostly used after [?1049h to clear screen
+  and when screen size changed during vi or raspi-config
+  flashwave TL1 use it without [?1049h for splash screen
+  freeBSD use it without [?1049h* for top and vi
+*/
+void Fl_Term_Core::screen_clear(int m0)
+{
+	int lines = size_y;
+	if ( m0==2 ) screen_y = cursor_y;
+	if ( m0==1 ) {
+		lines = cursor_y-screen_y;
+		buff_clear(line[cursor_y], cursor_x-line[cursor_y]+1);
+		cursor_y = screen_y;
+	}
+	if ( m0==0 ) {
+		buff_clear(cursor_x, line[cursor_y+1]-cursor_x);
+		lines = screen_y+size_y-cursor_y;
+	}
+	cursor_x = line[cursor_y];
+	int cy = cursor_y;
+	for ( int i=0; i<lines; i++ ) {
+		buff_clear(cursor_x, size_x);
+		cursor_x += size_x;
+		next_line();
+	}
+	cursor_y = cy;
+	if ( m0==2 || m0==0 ) screen_y--;
+	cursor_x = line[cursor_y];
+}
+void Fl_Term_Core::check_cursor_y()
+{
+	if ( cursor_y< screen_y )
+		cursor_y = screen_y;
+	if ( cursor_y> screen_y+size_y-1 )
+		cursor_y = screen_y+size_y-1;
+	if ( bOriginMode ) {
+		if ( cursor_y<screen_y+roll_top )
+			cursor_y = screen_y+roll_top;
+		if ( cursor_y>screen_y+roll_bot )
+			cursor_y = screen_y+roll_bot;
+	}
+}
+void Fl_Term_Core::termsize(int cols, int rows)
+{
+	if ( size_x!=cols || size_y!=rows ) {
+		size_x=cols; size_y=rows;
+		screen_clear(2);
+		notify();	//trigger window resizing
+	}
+}
+//escape sequence parser, a DEC style state machine driven by VT_action,
+//parameters of ESC[ are collected as numbers while the bytes arrive, so a
+//sequence split between two calls of append() continues where it stopped
+enum { VT_ESC, VT_CSI, VT_PARAM, VT_SKIP, VT_OSC, VT_CHARSET, VT_HASH };
+enum { VT_EXEC, VT_EXEC_END, VT_DISPATCH, VT_PRIV, VT_DIGIT, VT_SEMI,
+		VT_STOP, VT_IGNORE, VT_FINAL, VT_OSC_BYTE, VT_CHARSET_BYTE, VT_HASH_BYTE };
+
+#define K 0		//control byte
+#define D 1		//digit
+#define S 2		//';' parameter separator
+#define P 3		//private marker <=>?
+#define F 4		//final byte of ESC[, letters @ and `
+#define O 5		//everything else
+static const unsigned char VT_class[256] = {
+	K,K,K,K,K,K,K,K,K,K,K,K,K,K,K,K, K,K,K,K,K,K,K,K,K,K,K,K,K,K,K,K,
+	O,O,O,O,O,O,O,O,O,O,O,O,O,O,O,O, D,D,D,D,D,D,D,D,D,D,O,S,P,P,P,P,
+	F,F,F,F,F,F,F,F,F,F,F,F,F,F,F,F, F,F,F,F,F,F,F,F,F,F,F,O,O,O,O,O,
+	F,F,F,F,F,F,F,F,F,F,F,F,F,F,F,F, F,F,F,F,F,F,F,F,F,F,F,O,O,O,O,O,
+	O,O,O,O,O,O,O,O,O,O,O,O,O,O,O,O, O,O,O,O,O,O,O,O,O,O,O,O,O,O,O,O,
+	O,O,O,O,O,O,O,O,O,O,O,O,O,O,O,O, O,O,O,O,O,O,O,O,O,O,O,O,O,O,O,O,
+	O,O,O,O,O,O,O,O,O,O,O,O,O,O,O,O, O,O,O,O,O,O,O,O,O,O,O,O,O,O,O,O,
+	O,O,O,O,O,O,O,O,O,O,O,O,O,O,O,O, O,O,O,O,O,O,O,O,O,O,O,O,O,O,O,O
+};
+#undef K
+#undef D
+#undef S
+#undef P
+#undef F
+#undef O
+
+static const unsigned char VT_action[7][6] = {
+//	  control		digit			;				private			final			other
+	{ VT_EXEC_END,	VT_DISPATCH,	VT_DISPATCH,	VT_DISPATCH,	VT_DISPATCH,	VT_DISPATCH },	//VT_ESC
+	{ VT_EXEC,		VT_DIGIT,		VT_SEMI,		VT_PRIV,		VT_FINAL,		VT_STOP },		//VT_CSI
+	{ VT_EXEC,		VT_DIGIT,		VT_SEMI,		VT_STOP,		VT_FINAL,		VT_STOP },		//VT_PARAM
+	{ VT_EXEC,		VT_IGNORE,		VT_SEMI,		VT_IGNORE,		VT_FINAL,		VT_IGNORE },	//VT_SKIP
+	{ VT_EXEC,		VT_OSC_BYTE,	VT_OSC_BYTE,	VT_OSC_BYTE,	VT_OSC_BYTE,	VT_OSC_BYTE },	//VT_OSC
+	{ VT_EXEC,		VT_CHARSET_BYTE,VT_CHARSET_BYTE,VT_CHARSET_BYTE,VT_CHARSET_BYTE,VT_CHARSET_BYTE },//VT_CHARSET
+	{ VT_EXEC,		VT_HASH_BYTE,	VT_HASH_BYTE,	VT_HASH_BYTE,	VT_HASH_BYTE,	VT_HASH_BYTE }	//VT_HASH
+};
+
+const unsigned char *Fl_Term_Core::vt100_Escape(const unsigned char *sz, int cnt)
+{
+	const unsigned char *zz = sz+cnt;
+	if ( !bEscape ) {
+		bEscape = true;
+		ESC_state = VT_ESC;
+		ESC_idx = 0;
+	}
+	while ( sz<zz && bEscape ){
+		unsigned char c = *sz++;
+		if ( c>31 ) ESC_idx++;
+		switch ( VT_action[ESC_state][VT_class[c]] ) {
+		case VT_EXEC_END:
+			bEscape = false;	//fall through
+		case VT_EXEC:
+			vt100_ctrl(c);
+			break;
+		case VT_DISPATCH:
+			vt100_esc(c);
+			break;
+		case VT_PRIV:
+			ESC_priv = c;
+			ESC_state = VT_PARAM;
+			break;
+		case VT_DIGIT: {
+				int &n = ESC_args[ESC_argc-1];
+				if ( n<0 ) n = 0;
+				if ( n<100000 ) n = n*10+c-'0';
+				ESC_state = VT_PARAM;
+			}
+			break;
+		case VT_SEMI:
+			if ( ESC_argc<16 ) {
+				ESC_args[ESC_argc++] = -1;
+				ESC_state = VT_PARAM;
+			}
+			else
+				ESC_state = VT_SKIP;
+			break;
+		case VT_STOP:		//like atoi(), a parameter ends at the first
+			ESC_state = VT_SKIP;	//byte that is not a digit
+			break;
+		case VT_IGNORE:
+			break;
+		case VT_FINAL:
+			bEscape = false;
+			vt100_csi(c);
+			break;
+		case VT_OSC_BYTE:	//only ESC]0; is used, for window title
+			if ( c==';' ) {
+				if ( ESC_priv=='0' ) {
+					bTitle = true;
+					title_idx = 0;
+				}
+				bEscape = false;
+			}
+			else if ( ESC_idx==2 )
+				ESC_priv = c;
+			break;
+		case VT_CHARSET_BYTE:	//character sets, 0 for line drawing
+			bGraphic = (c=='0');
+			bEscape = false;
+			break;
+		case VT_HASH_BYTE:
+			if ( c=='8' )
+				buff.fill(line[screen_y], 'E', size_x*size_y);
+			bEscape = false;
+			break;
+		}
+		if ( ESC_idx==31 ) bEscape = false;
+	}
+	return sz;
+}
+void Fl_Term_Core::vt100_ctrl(unsigned char c)
+{//control bytes that still take effect inside an escape sequence
+	switch ( c ) {
+	case 0x08:	//BS
+		if ( (buff[cursor_x--]&0xc0)==0x80 )//utf8 continuation byte
+			while ( (buff[cursor_x]&0xc0)==0x80 ) cursor_x--;
+		break;
+	case 0x0b: {//VT
+		int x = cursor_x-line[cursor_y];
+		cursor_x = line[++cursor_y]+x;
+		break;
+		}
+	case 0x0d:	//CR
+		cursor_x = line[cursor_y];
+		break;
+	}
+}
+void Fl_Term_Core::vt100_esc(unsigned char c)
+{//the byte after ESC, either a complete sequence or the start of one
+	bEscape = false;
+	switch ( c ) {
+	case '[':
+		bEscape = true;
+		ESC_state = VT_CSI;
+		ESC_priv = 0;
+		ESC_argc = 1;
+		ESC_args[0] = -1;
+		break;
+	case ']': //set window title
+		bEscape = true;
+		ESC_state = VT_OSC;
+		ESC_priv = 0;
+		break;
+	case ')':
+	case '(':
+		bEscape = true;
+		ESC_state = VT_CHARSET;
+		break;
+	case '#':
+		bEscape = true;
+		ESC_state = VT_HASH;
+		break;
+	case '7': //save cursor
+		save_x = cursor_x-line[cursor_y];
+		save_y = cursor_y-screen_y;
+		save_attr = c_attr;
+		break;
+	case '8': //restore cursor
+		cursor_y = save_y+screen_y;
+		cursor_x = line[cursor_y]+save_x;
+		c_attr = save_attr;
+		break;
+	case 'F': //cursor to lower left corner
+		cursor_y = screen_y+size_y-1;
+		cursor_x = line[cursor_y];
+		break;
+	case 'E': //move to next line
+		cursor_x = line[++cursor_y];
+		break;
+	case 'D': //move/scroll up one line
+		if ( cursor_y<screen_y+roll_bot ) {	//move
+			int x = cursor_x-line[cursor_y];
+			cursor_x = line[++cursor_y]+x;
+		}
+		else {								//scroll
+			int len = line[screen_y+roll_bot+1]-line[screen_y+roll_top+1];
+			int x = cursor_x-line[cursor_y];
+			buff_copy(line[screen_y+roll_top], line[screen_y+roll_top+1], len);
+			len = line[screen_y+roll_top+1]-line[screen_y+roll_top];
+			for ( int i=roll_top+1; i<=roll_bot; i++ )
+				line[screen_y+i] = line[screen_y+i+1]-len;
+			touch_rows(screen_y+roll_top, roll_bot-roll_top+1);
+			buff_clear(line[screen_y+roll_bot], 
+				line[screen_y+roll_bot+1]-line[screen_y+roll_bot]);
+			cursor_x = line[cursor_y]+x;
+		}
+		break;
+	case 'M': //move/scroll down one line
+		if ( cursor_y>screen_y+roll_top ) {	// move
+			int x = cursor_x-line[cursor_y];
+			cursor_x = line[--cursor_y]+x;
+		}
+		else {								//scroll
+			for ( int i=roll_bot; i>roll_top; i-- )
+				buff_copy(line[screen_y+i], line[screen_y+i-1], size_x);
+			buff_clear(line[screen_y+roll_top], size_x);
+		}
+		break;
+	case 'H': //set tabstop
+		tabstops[cursor_x-line[cursor_y]] = 1;
+		break;
+	}
+}
+void Fl_Term_Core::vt100_csi(unsigned char c)
+{//ESC[ sequence with final byte c
+	int m0=0;	//used by [PsJ and [PsK
+	int n0=1;	//used by most, e.g. [PsA [PsB
+	int n1=1;	//n1;n0 used by [Ps;PtH [Ps;Ptr
+	if ( ESC_priv==0 && ESC_args[0]>=0 ) {
+		m0 = n0 = ESC_args[0];
+		if ( n0==0 ) n0=1;
+	}
+	if ( ESC_argc>1 ) {
+		n1 = n0;
+		n0 = ESC_args[1];
+		if ( n0<=0 ) n0=1;	//ESC[0;0f == ESC[1;1f
+	}
+	int x;
+	switch ( c ) {
+	case 'A': //cursor up n0 times
+		x = cursor_x-line[cursor_y];
+		cursor_y -=n0;
+		check_cursor_y();
+		cursor_x = line[cursor_y]+x;
+		break;
+	case 'd'://line position absolute
+		x = cursor_x-line[cursor_y];
+		if ( n0>size_y ) n0 = size_y;
+		cursor_y = screen_y+n0-1;
+		cursor_x = line[cursor_y]+x;
+		break;
+	case 'e': //line position relative
+	case 'B': //cursor down n0 times
+		x = cursor_x-line[cursor_y];
+		cursor_y += n0;
+		check_cursor_y();
+		cursor_x = line[cursor_y]+x;
+		break;
+	case '`': //character position absolute
+	case 'G': //cursor to n0th position from left
+		cursor_x = line[cursor_y];
+		//fall through
+	case 'a': //character position relative
+	case 'C': //cursor forward n0 times
+		while ( n0-->0 && cursor_x<line[cursor_y]+size_x-1 ) {
+			if ( (buff[++cursor_x]&0xc0)==0x80 )
+				while ( (buff[++cursor_x]&0xc0)==0x80 );
+		}
+		break;
+	case 'D': //cursor backward n0 times
+		while ( n0-->0 && cursor_x>line[cursor_y] ) {
+			if ( (buff[--cursor_x]&0xc0)==0x80 )
+				while ( (buff[--cursor_x]&0xc0)==0x80 );
+		}
+		break;
+	case 'E': //cursor to begining of next line n0 times
+		cursor_y += n0;
+		check_cursor_y();
+		cursor_x = line[cursor_y];
+		break;
+	case 'F': //cursor to begining of previous line n0 times
+		cursor_y -= n0;
+		check_cursor_y();
+		cursor_x = line[cursor_y];
+		break;
+	case 'f': //horizontal/vertical position forced, apt install
+		for ( int i=cursor_y+1; i<screen_y+n1; i++ )
+			if ( i<=screen_y+size_y && line[i]<cursor_x ) {
+				line[i] = cursor_x;
+				touch_rows(i-1, 2);
+			}
+		//fall through
+	case 'H': //cursor to line n1, postion n0
+		if ( !bAltScreen && n1>size_y ) {
+			cursor_y = (screen_y++) + size_y;
+		}
+		else {
+			cursor_y = screen_y+n1-1;
+			if ( bOriginMode ) cursor_y+=roll_top;
+			check_cursor_y();
+		}
+		cursor_x = line[cursor_y];
+		while ( --n0>0 ) {
+			cursor_x++;
+			while ( (buff[cursor_x]&0xc0)==0x80 ) cursor_x++;
+		}
+		break;
+	case 'J': //[0J kill till end, 1J begining, 2J entire screen
+		if ( (ESC_priv==0 && ESC_args[0]>=0) || bAltScreen ) {
+			screen_clear(m0);
+		}
+		else {//clear in none alter screen, used in apt install
+			line[cursor_y+1] = cursor_x;
+			for (int i=cursor_y+2; i<=screen_y+size_y+1; i++)
+				line[i] = 0;
+			touch_rows(cursor_y, screen_y+size_y+1-cursor_y);
+		}
+		break;
+	case 'K': {//[K erase till line end, 1K begining, 2K entire line
+			int a=line[cursor_y];
+			int z=line[cursor_y+1];
+			if ( m0==0 ) a = cursor_x;
+			if ( m0==1 ) z = cursor_x+1;
+			if ( z>a ) buff_clear(a, z-a);
+		}
+		break;
+	case 'L': //insert n0 lines
+		if ( n0 > screen_y+roll_bot-cursor_y )
+			n0 = screen_y+roll_bot-cursor_y+1;
+		else
+			for ( int i=screen_y+roll_bot; i>=cursor_y+n0; i-- )
+				buff_copy( line[i], line[i-n0], size_x );
+		cursor_x = line[cursor_y];
+		buff_clear(cursor_x, size_x*n0);
+		break;
+	case 'M': //delete n0 lines
+		if ( n0 > screen_y+roll_bot-cursor_y )
+			n0 = screen_y+roll_bot-cursor_y+1;
+		else
+			for ( int i=cursor_y; i<=screen_y+roll_bot-n0; i++ )
+				buff_copy( line[i], line[i+n0], size_x);
+		cursor_x = line[cursor_y];
+		buff_clear(line[screen_y+roll_bot-n0+1], size_x*n0);
+		break;
+	case 'P': //delete n0 characters
+		if ( cursor_x+n0<line[cursor_y+1] )
+			buff_copy(cursor_x, cursor_x+n0,
+						line[cursor_y+1]-n0-cursor_x);
+		buff_clear(line[cursor_y+1]-n0, n0);
+		if ( !bAltScreen ) {
+			line[cursor_y+1]-=n0;
+			if ( line[cursor_y+1]<line[cursor_y] )
+				line[cursor_y+1] =line[cursor_y];
+			touch_rows(cursor_y, 2);
+		}
+		break;
+	case '@': //insert n0 spaces
+		if ( line[cursor_y+1]-n0>cursor_x )
+			buff_copy(cursor_x+n0, cursor_x,
+						line[cursor_y+1]-n0-cursor_x);
+		if ( !bAltScreen ) {
+			line[cursor_y+1]+=n0;
+			if ( line[cursor_y+1]>line[cursor_y]+size_x )
+				line[cursor_y+1] =line[cursor_y]+size_x;
+			touch_rows(cursor_y, 2);
+		}//fall through
+	case 'X': //erase n0 characters
+		buff_clear(cursor_x, n0);
+		break;
+	case 'I': //cursor forward n0 tab stops
+		break;
+	case 'Z': //cursor backward n0 tab stops
+		break;
+	case 'S': // scroll up n0 lines
+		for ( int i=roll_top; i<=roll_bot-n0; i++ )
+			buff_copy( line[screen_y+i], line[screen_y+i+n0], size_x);
+		buff_clear(line[screen_y+roll_bot-n0+1], n0*size_x);
+		break;
+	case 'T': // scroll down n0 lines
+		for ( int i=roll_bot; i>=roll_top+n0; i-- )
+			buff_copy( line[screen_y+i], line[screen_y+i-n0], size_x);
+		buff_clear(line[screen_y+roll_top], n0*size_x);
+		break;
+	case 'c': // send device attributes
+		answer("\033[?1;2c", 7);	//vt100 with options
+		break;
+	case 'g': // set tabstops
+		if ( m0==0 ) { //clear current tab
+			tabstops[cursor_x-line[cursor_y]] = 0;
+		}
+		if ( m0==3 ) { //clear all tab stops
+			memset(tabstops, 0, 256);
+		}
+		break;
+	case 'h':
+		if ( ESC_priv==0 && ESC_args[0]==4 ) bInsert=true;
+		if ( ESC_priv=='?' ) {
+			switch( ESC_args[0] ) {
+			case 1: bAppCursor = true; 	break;
+			case 3:	termsize(132, 25);  break;
+			case 6: bOriginMode = true; break;
+			case 7: bWraparound = true; break;
+			case 25:	bCursor = true; break;
+			case 2004: bBracket = true; break;
+			case 1049: bAltScreen = true;//?1049h alternate screen
+					screen_clear(2);
+			}
+		}
+		break;
+	case 'l':
+		if ( ESC_priv==0 && ESC_args[0]==4 ) bInsert=false;
+		if ( ESC_priv=='?' ) {
+			switch( ESC_args[0] ) {
+			case 1: bAppCursor = false; break;
+			case 3:	termsize(80, 25);   break;
+			case 6: bOriginMode= false; break;
+			case 7: bWraparound= false; break;
+			case 25:	bCursor= false; break;
+			case 2004: bBracket= false; break;
+			case 1049: bAltScreen= false;//?1049l alternate screen
+					cursor_y = screen_y;
+					cursor_x = line[cursor_y];
+					for ( int i=1; i<=size_y+1; i++ )
+						line[cursor_y+i] = 0;
+					screen_y = cursor_y-size_y+1;
+					if ( screen_y<0 ) screen_y = 0;
+					touch_rows(screen_y, cursor_y+size_y+2-screen_y);
+			}
+		}
+		break;
+	case 'm': //text style, color attributes, private ones like ESC[>4m ignored
+		for ( int i=0; i<ESC_argc && ESC_priv==0; i++ ) {
+			m0 = ESC_args[i]<0 ? 0 : ESC_args[i];
+			switch ( m0/10 ) {
+			case 0: if ( m0==0 ) c_attr = 7;	//normal
+					if ( m0==1 ) c_attr|=0x08;	//bright
+					if ( m0==7 ) c_attr =0x70;	//negative
+					break;
+			case 2: c_attr = 7; 				//normal
+					break;
+			case 3: if ( m0==39 ) m0 = 7;//default foreground
+					c_attr = (c_attr&0xf8)+m0%10;
+					break;
+			case 4: if ( m0==49 ) m0 = 0;//default background
+					c_attr = (c_attr&0x0f)+((m0%10)<<4);
+					break;
+			case 9: c_attr = (c_attr&0xf0) + m0%10 + 8;
+					break;
+			case 10:c_attr = (c_attr&0x0f) + ((m0%10+8)<<4);
+					break;
+			}
+		}
+		break;
+	case 'r': //set margins and move cursor to home
+		if ( n1==1 && n0==1 ) n0=size_y;	//ESC[r
+		roll_top=n1-1; roll_bot=n0-1;
+		cursor_y = screen_y;
+		if ( bOriginMode ) cursor_y+=roll_top;
+		cursor_x = line[cursor_y];
+		break;
+	case 's': //save cursor
+		save_x = cursor_x-line[cursor_y];
+		save_y = cursor_y-screen_y;
+		break;
+	case 'u': //restore cursor
+		cursor_y = save_y+screen_y;
+		cursor_x = line[cursor_y]+save_x;
+		break;
+	}
+}
+void Fl_Term_Core::logg(const char *fn)
+{
+	if ( logger.active() ) {
+		logger.close();
+		disp("\r\n\033[32m***logging off ");
+		disp(LogFileName);
+		free(LogFileName);
+		LogFileName = NULL;
+		if ( logger.lost()>0 ) {
+			char msg[64];
+			snprintf(msg, 64, ", %u bytes dropped", logger.lost());
+			disp(msg);
+		}
+	}
+	else {
+		if ( logger.open(fn) ) {
+			LogFileName = strdup(fn);
+			disp("\r\n\033[32m***logging on ");
+			disp(LogFileName);
+		}
+		else {
+			disp("\r\n\033[31m***Failed to open logfile");
+		}
+	}
+	disp("***\033[37m\r\n");
+}
+//case insensitive search in [p, p+n) for the l bytes at up, which are
+//upper cased already, returns offset of the first match, or of the last
+//one if back, -1 if none. SSE2 checks 16 starts at a time for the first
+//and last byte before comparing the rest
+static bool fold_eq(const char *p, const char *up, int l)
+{
+	for ( int i=0; i<l; i++ )
+		if ( toupper((unsigned char)p[i])!=(unsigned char)up[i] ) return false;
+	return true;
+}
+static int fold_find(const char *p, int n, const char *up, int l, bool back)
+{
+	int last = n-l;
+	if ( last<0 ) return -1;
+	int i = back ? last : 0;
+#ifdef __SSE2__
+	const __m128i f0 = _mm_set1_epi8(up[0]);
+	const __m128i f1 = _mm_set1_epi8(tolower((unsigned char)up[0]));
+	const __m128i l0 = _mm_set1_epi8(up[l-1]);
+	const __m128i l1 = _mm_set1_epi8(tolower((unsigned char)up[l-1]));
+	for ( ; back ? i>=15 : i+15<=last; i+=back ? -16 : 16 ) {
+		const char *q = back ? p+i-15 : p+i;
+		__m128i a = _mm_loadu_si128((const __m128i *)q);
+		__m128i z = _mm_loadu_si128((const __m128i *)(q+l-1));
+		a = _mm_or_si128(_mm_cmpeq_epi8(a, f0), _mm_cmpeq_epi8(a, f1));
+		z = _mm_or_si128(_mm_cmpeq_epi8(z, l0), _mm_cmpeq_epi8(z, l1));
+		int mask = _mm_movemask_epi8(_mm_and_si128(a, z));
+		while ( mask!=0 ) {
+			int j = back ? 31-__builtin_clz(mask) : __builtin_ctz(mask);
+			if ( fold_eq(q+j, up, l) ) return q+j-p;
+			mask &= ~(1<<j);
+		}
+	}
+#endif
+	for ( ; back ? i>=0 : i<=last; i+=back ? -1 : 1 )
+		if ( fold_eq(p+i, up, l) ) return i;
+	return -1;
+}
+//one bit for each upper cased byte pair in the chunk at i, built when the
+//chunk is frozen, so srch() can pass over it without decompressing it.
+//Chunks are only frozen once they scrolled off, nothing writes them later
+void Fl_Term_Core::gram_build(int i)
+{
+	if ( gram_mask<0 || !buff.mapped(i) || buff.frozen(i) ) return;
+	unsigned char *&g = grams[(i>>TERM_CHUNK_BITS)&gram_mask];
+	if ( g!=NULL ) return;
+	g = (unsigned char *)calloc(TERM_GRAM_SIZE, 1);
+	if ( g==NULL ) return;
+	const unsigned char *p = (const unsigned char *)&buff[i];
+	int n = 1<<TERM_CHUNK_BITS;
+	int a = toupper(p[0]);
+	for ( int j=1; j<n; j++ ) {
+		int b = toupper(p[j]);
+		g[(a<<5)|(b>>3)] |= 1<<(b&7);
+		a = b;
+	}
+	g[TERM_GRAM_SIZE-2] = toupper(p[0]);
+	g[TERM_GRAM_SIZE-1] = a;
+}
+//true when no match can start in the chunk at i, some pair of the word
+//is neither in this chunk, nor the next one, nor across the two
+bool Fl_Term_Core::gram_skip(int i, const char *up, int l)
+{
+	if ( l<2 || gram_mask<0 || i+(1<<TERM_CHUNK_BITS)>=buff_top ) return false;
+	unsigned char *g0 = grams[(i>>TERM_CHUNK_BITS)&gram_mask];
+	unsigned char *g1 = grams[((i>>TERM_CHUNK_BITS)+1)&gram_mask];
+	if ( g0==NULL || g1==NULL ) return false;
+	const unsigned char *u = (const unsigned char *)up;
+	for ( int j=0; j<l-1; j++ ) {
+		int a = u[j], b = u[j+1];
+		if ( g0[(a<<5)|(b>>3)]&(1<<(b&7)) ) continue;
+		if ( g1[(a<<5)|(b>>3)]&(1<<(b&7)) ) continue;
+		if ( a==g0[TERM_GRAM_SIZE-1] && b==g1[TERM_GRAM_SIZE-2] ) continue;
+		return true;
+	}
+	return false;
+}
+//start of the first match of up in [from, to), or the last one if back,
+//-1 if none. Each chunk is searched in place, matches that cross into
+//the next chunk are checked one by one
+int Fl_Term_Core::find(const char *up, int l, int from, int to, bool back)
+{
+	const int chunk = 1<<TERM_CHUNK_BITS;
+	if ( l<=0 || l>chunk || to-from<l ) return -1;
+	int first = from&~(chunk-1);
+	int last = (to-l)&~(chunk-1);
+	for ( int c=back?last:first; back?c>=first:c<=last; c+=back?-chunk:chunk ) {
+		if ( gram_skip(c, up, l) ) continue;
+		int a = c>from ? c : from;				//starts in [a, b]
+		int b = c+chunk-1<to-l ? c+chunk-1 : to-l;
+		int e = c+chunk<to ? c+chunk : to;		//in place up to e
+		int s = e-l+1>a ? e-l+1 : a;			//crossing from s
+		thaw(a, b+l-a);
+		int m = -1;
+		if ( !back ) m = fold_find(&buff[a], e-a, up, l, false);
+		if ( m>=0 ) return a+m;
+		for ( int i=back?b:s; back?i>=s:i<=b; i+=back?-1:1 ) {
+			int j;
+			for ( j=0; j<l; j++ )
+				if ( toupper((unsigned char)buff[i+j])!=(unsigned char)up[j] )
+					break;
+			if ( j==l ) return i;
+		}
+		if ( back ) m = fold_find(&buff[a], e-a, up, l, true);
+		if ( m>=0 ) return a+m;
+	}
+	return -1;
+}
+void Fl_Term_Core::put_xml(const char *buf, int len)
+{
+	const char *p=buf, *q;
+	const char spaces[256]="\r\n                                               \
+                                                                              ";
+	if ( strncmp(buf, "<?xml ", 6)==0 ) {
+		xmlIndent = 0;
+		xmlTagIsOpen = true;
+	}
+	while ( *p!=0 && *p!='<' ) p++;
+	if ( p>buf ) append(buf, p-buf);
+	while ( *p!=0 && p<buf+len ) {
+		while (*p==0x0d || *p==0x0a || *p=='\t' || *p==' ') p++;
+		if ( *p==']' && p+6<=buf+len) {//end of message
+			if ( strncmp(p, "]]>]]>", 6)==0 ) {
+				append("]]>]]>\n\033[37m", 12);
+				p+=6;
+			}
+		}
+		else if ( *p=='<' ) { //tag
+			if ( p[1]=='/' ) {
+				if ( !xmlTagIsOpen ) {
+					xmlIndent -= 2;
+					append(spaces, xmlIndent);
+				}
+				xmlTagIsOpen = false;
+			}
+			else {
+				if ( xmlTagIsOpen ) xmlIndent+=2;
+				append(spaces, xmlIndent);
+				xmlTagIsOpen = true;
+			}
+			append("\033[32m",5);
+			q = strchr(p, '>');
+			if ( q==NULL ) q = p+strlen(p);
+			const char *r = strchr(p, ' ');
+			if ( r!=NULL && r<q ) {
+				append(p, r-p);
+				append("\033[34m",5);
+				append(r, q-r);
+			}
+			else
+				append(p, q-p);
+			append("\033[32m>",6);
+			p = q;
+			if ( *q=='>' ) {
+				p++;
+				if ( q[-1]=='/' ) xmlTagIsOpen = false;
+			}
+		}
+		else {		//data
+			append("\033[33m",5);
+			q = strchr(p, '<');
+			if ( q==NULL ) q = p+strlen(p);
+			append(p, q-p);
+			p = q;
+		}
+	}
+}
+#define TNO_IAC		0xff
+#define TNO_DONT	0xfe
+#define TNO_DO		0xfd
+#define TNO_WONT	0xfc
+#define TNO_WILL	0xfb
+#define TNO_SUB		0xfa
+#define TNO_SUBEND	0xf0
+#define TNO_ECHO	0x01
+#define TNO_AHEAD	0x03
+#define TNO_STATUS	0x05
+#define TNO_LOGOUT	0x12
+#define TNO_WNDSIZE 0x1f
+#define TNO_TERMTYPE 0x18
+#define TNO_NEWENV	0x27
+unsigned char TERMTYPE[]={//vt100
+	0xff, 0xfa, 0x18, 0x00, 0x76, 0x74, 0x31, 0x30, 0x30, 0xff, 0xf0
+};
+const unsigned char *Fl_Term_Core::telnet_options(const unsigned char *p, int cnt)
+{
+	const unsigned char *q = p+cnt;
+	while ( *p==0xff && p<q ) {
+		unsigned char negoreq[]={0xff,0,0,0, 0xff, 0xf0};
+		switch ( p[1] ) {
+			case TNO_WONT:
+			case TNO_DONT:
+				p+=3;
+				break;
+			case TNO_DO:
+				negoreq[1]=TNO_WONT; negoreq[2]=p[2];
+				if ( p[2]==TNO_TERMTYPE || p[2]==TNO_NEWENV
+					|| p[2]==TNO_ECHO || p[2]==TNO_AHEAD ) {
+					negoreq[1]=TNO_WILL;
+					if ( *p==TNO_ECHO ) bEcho = true;
+				}
+				answer((const char *)negoreq, 3);
+				p+=3;
+				break;
+			case TNO_WILL:
+				negoreq[1]=TNO_DONT; negoreq[2]=p[2];
+				if ( p[2]==TNO_ECHO || p[2]==TNO_AHEAD ) {
+					negoreq[1]=TNO_DO;
+					if ( p[2]==TNO_ECHO ) bEcho = false;
+				}
+				answer((const char *)negoreq, 3);
+				p+=3;
+				break;
+			case TNO_SUB:
+				negoreq[1]=TNO_SUB; negoreq[2]=p[2];
+				if ( p[2]==TNO_TERMTYPE ) {
+					answer((const char *)TERMTYPE, sizeof(TERMTYPE));
+				}
+				if ( p[2]==TNO_NEWENV ) {
+					answer((const char *)negoreq, 6);
+				}
+				while (*p!=0xff && p<q ) p++;
+				break;
+			case TNO_SUBEND:
+				p+=2;
+		}
+	}
+	return p+1;
+}
@@ -0,0 +1,545 @@
+//
+// Fl_Term_Core -- terminal emulation without a display
+//
+// This library is free software distributed under GNU GPL 3.0,
+// see the license at:
+//
+//     https://github.com/yongchaofan/tinyTerm2/blob/master/LICENSE
+//
+// Please report all bugs and problems on the following page:
+//
+//     https://github.com/yongchaofan/tinyTerm2/issues/new
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <new>
+
+#ifndef _FL_TERM_CORE_H_
+#define _FL_TERM_CORE_H_
+
+#define TERM_CHUNK_BITS	18		//256K characters per scroll buffer chunk
+#define TERM_LINES_BITS	12		//4096 line positions per line chunk
+#define TERM_RUNS_BITS	12		//4096 attribute runs per run chunk
+#define TERM_LINE_ROOM	16384	//room kept ahead of cursor for current line
+#define TERM_HOT_PAGES	4		//pages above the screen kept uncompressed
+#define TERM_APPEND_SLICE	16384	//bytes parsed between calls of reclaim()
+#define TERM_DIRTY_ROWS	1024	//rows with a dirty bit, by line index modulo
+#define TERM_GRAM_SIZE	(65536/8+2)	//pair bitmap, first and last byte
+#define TERM_LOG_SIZE	(1<<22)	//bytes queued for the log writer thread
+#define TERM_LOG_STAMPS	4096	//arrival times of queued bytes
+#define TERM_EXPECT_MAX	32		//patterns a script can wait for at once
+#define TERM_EXPECT_LEN	256		//bytes of prompts or of expected strings
+
+char *term_pack(const void *src, int len);	//compressed copy, NULL on failure
+bool term_unpack(const char *pack, void *dst, int len);
+char *term_pack_dup(const char *pack);
+const char *term_map(const char *fn, long long *size);	//read-only mapping
+void term_unmap(const char *p, long long size);
+
+//chunked storage for the scroll buffer, element i lives in chunk i>>BITS,
+//chunks are found through a ring of pointers, so adding or dropping chunks
+//never moves text already in the buffer. Slots without a chunk point to a
+//scratch chunk of the ring's own, so a stale position reads zeros instead
+//of crashing, and a stale write can't reach the buffer of another tab.
+//A cold chunk can be frozen into a compressed copy, and thawed back on use.
+//Chunks are reference counted, the ring holds one reference and pin() one
+//more, so a pinned chunk outlives being dropped, frozen or cleared.
+//Swapping a chunk in or out of its slot takes slot_mtx, so copy() works
+//from any thread without the lock of the view
+template <class T, int BITS> class Fl_Term_Ring {
+	T **slot;
+	char **pack;	//compressed copy of each frozen chunk
+	int mask;
+	std::mutex slot_mtx;
+	T *scratch;
+	enum { HEAD = 16 };	//reference count ahead of the elements
+	static std::atomic<int> *refs(const T *p)
+	{
+		return (std::atomic<int> *)((char *)p-HEAD);
+	}
+	static T *chunk(bool zero)
+	{
+		int size = HEAD+(sizeof(T)<<BITS);
+		char *p = (char *)(zero ? calloc(1, size) : malloc(size));
+		if ( p==NULL ) return NULL;
+		new (p) std::atomic<int>(1);
+		return (T *)(p+HEAD);
+	}
+
+public:
+	static void unref(const T *p)	//frees the chunk with its last reference
+	{
+		if ( --*refs(p)==0 ) free((char *)p-HEAD);
+	}
+	Fl_Term_Ring()
+	{
+		slot = NULL;
+		pack = NULL;
+		mask = 0;
+		scratch = (T *)calloc(1<<BITS, sizeof(T));	//untouched pages, no RAM
+	}
+	~Fl_Term_Ring() { slots(0); free(scratch); }
+	void slots(int cnt)		//free all chunks, then make cnt(power of 2) slots
+	{
+		std::lock_guard<std::mutex> lck(slot_mtx);
+		for ( int i=0; i<=mask && slot!=NULL; i++ ) {
+			if ( slot[i]!=scratch ) unref(slot[i]);
+			free(pack[i]);
+		}
+		free(slot);
+		free(pack);
+		slot = NULL;
+		pack = NULL;
+		mask = 0;
+		if ( cnt>0 ) {
+			slot = (T **)malloc(cnt*sizeof(T *));
+			pack = (char **)calloc(cnt, sizeof(char *));
+			for ( int i=0; i<cnt; i++ ) slot[i] = scratch;
+			mask = cnt-1;
+		}
+	}
+	int span() { return (mask+1)<<BITS; }
+	T &operator[](int i) { return slot[(i>>BITS)&mask][i&((1<<BITS)-1)]; }
+	bool mapped(int i) { return slot[(i>>BITS)&mask]!=scratch; }
+	bool map(int i)			//allocate the zero filled chunk holding i
+	{
+		T *&s = slot[(i>>BITS)&mask];
+		if ( s==scratch ) {
+			T *p = chunk(true);
+			if ( p==NULL ) return false;
+			std::lock_guard<std::mutex> lck(slot_mtx);
+			s = p;
+		}
+		return true;
+	}
+	void unmap(int i)		//free the chunk holding i
+	{
+		int k = (i>>BITS)&mask;
+		std::lock_guard<std::mutex> lck(slot_mtx);
+		if ( slot[k]!=scratch ) {
+			unref(slot[k]);
+			slot[k] = scratch;
+		}
+		free(pack[k]);
+		pack[k] = NULL;
+	}
+	bool frozen(int i) { return pack[(i>>BITS)&mask]!=NULL; }
+	void freeze(int i)		//replace the chunk holding i by a compressed copy
+	{
+		int k = (i>>BITS)&mask;
+		if ( slot[k]==scratch || pack[k]!=NULL ) return;
+		char *z = term_pack(slot[k], sizeof(T)<<BITS);
+		if ( z!=NULL ) {
+			std::lock_guard<std::mutex> lck(slot_mtx);
+			pack[k] = z;
+			unref(slot[k]);
+			slot[k] = scratch;
+		}
+	}
+	bool thaw(int i)		//decompress the chunk holding i back in place
+	{
+		int k = (i>>BITS)&mask;
+		if ( pack[k]==NULL ) return true;
+		T *p = chunk(false);
+		if ( p==NULL ) return false;
+		if ( !term_unpack(pack[k], p, sizeof(T)<<BITS) ) {
+			unref(p);
+			return false;
+		}
+		std::lock_guard<std::mutex> lck(slot_mtx);
+		slot[k] = p;
+		free(pack[k]);		//it may be written again once thawed
+		pack[k] = NULL;
+		return true;
+	}
+	bool copy(int i, T *dst)	//the chunk holding i, a frozen one is unpacked
+	{							//into dst and stays frozen, false if not mapped
+		int k = (i>>BITS)&mask;
+		char *z = NULL;
+		const T *p = NULL;
+		{
+			std::lock_guard<std::mutex> lck(slot_mtx);
+			if ( pack[k]!=NULL ) z = term_pack_dup(pack[k]);
+			else if ( slot[k]!=scratch ) p = pin(i);
+		}
+		if ( p!=NULL ) {
+			memcpy(dst, p, sizeof(T)<<BITS);
+			unref(p);
+			return true;
+		}
+		bool ok = z!=NULL && term_unpack(z, dst, sizeof(T)<<BITS);
+		free(z);
+		return ok;
+	}
+	const T *pin(int i)		//referenced chunk holding i, NULL if not mapped
+	{
+		T *s = slot[(i>>BITS)&mask];
+		if ( s==scratch ) return NULL;
+		++*refs(s);
+		return s;
+	}
+	int run(int i, int n)	//number of elements contiguous from i, up to n
+	{
+		int room = (1<<BITS)-(i&((1<<BITS)-1));
+		return n<room ? n : room;
+	}
+	void get(T *dst, int from, int n)
+	{
+		while ( n>0 ) {
+			int l = run(from, n);
+			memcpy(dst, &(*this)[from], l*sizeof(T));
+			dst+=l; from+=l; n-=l;
+		}
+	}
+	void put(int to, const T *src, int n)
+	{
+		while ( n>0 ) {
+			int l = run(to, n);
+			memcpy(&(*this)[to], src, l*sizeof(T));
+			src+=l; to+=l; n-=l;
+		}
+	}
+	void fill(int from, T v, int n)
+	{
+		while ( n>0 ) {
+			int l = run(from, n);
+			T *p = &(*this)[from];
+			for ( int i=0; i<l; i++ ) p[i] = v;
+			from+=l; n-=l;
+		}
+	}
+	void move(int to, int from, int n)	//memmove across chunks
+	{
+		if ( to<=from ) while ( n>0 ) {
+			int l = run(to, run(from, n));
+			memmove(&(*this)[to], &(*this)[from], l*sizeof(T));
+			to+=l; from+=l; n-=l;
+		}
+		else while ( n>0 ) {
+			int l = ((to+n-1)&((1<<BITS)-1))+1;
+			int k = ((from+n-1)&((1<<BITS)-1))+1;
+			if ( k<l ) l = k;
+			if ( n<l ) l = n;
+			n-=l;
+			memmove(&(*this)[to+n], &(*this)[from+n], l*sizeof(T));
+		}
+	}
+};
+
+//character attributes kept as runs of the same attribute, run k starts at
+//position pos[k] and ends where run k+1 starts, the last one ends at end.
+//Positions never written read as 0, like a freshly mapped chunk did
+class Fl_Term_Attr {
+	Fl_Term_Ring<int, TERM_RUNS_BITS> pos;	//starting position of each run
+	Fl_Term_Ring<char, TERM_RUNS_BITS> val;	//attribute of each run
+	int first;		//oldest run still kept
+	int top;		//runs are first..top-1
+	int end;		//attributes are written up to end
+	int *move_at;	//runs copied out by move(), kept for the next one
+	char *move_va;
+	int move_room;
+	void add(int p, char v);
+	void splice(int k, int cnt, int *at, char *va, int n);
+
+public:
+	Fl_Term_Attr() { first=top=end=0; move_at=NULL; move_va=NULL; move_room=0; }
+	~Fl_Term_Attr() { free(move_at); free(move_va); }
+	void slots(int cnt);
+	int find(int i);
+	int run(int &k, int i, char &v);
+	char get(int i)		{ int k=-1; char v; run(k, i, v); return v; }
+	void set(int i, char v)
+	{
+		if ( i==end && top>first && val[top-1]==v ) end++;
+		else fill(i, v, 1);
+	}
+	void fill(int i, char v, int n);
+	void move(int to, int from, int n);
+	void trim(int p);
+	void rebase(int dx);
+};
+
+//session log, append() copies into a ring and a writer thread drains it
+//in large writes, so a slow disk never stalls the reader. When the ring
+//is full the whole slice is dropped and counted instead of waiting.
+//The writer also stamps lines, rotates files and keeps a sidecar index
+//name.idx with a "milliseconds offset" line for each second of output
+class Fl_Term_Log {
+	FILE *fp;
+	FILE *ip;			//sidecar index of fp
+	char *name;			//file name given to open()
+	char *ring;
+	std::atomic<unsigned> head, tail;
+	std::atomic<unsigned> dropped;
+	unsigned stamp_pos[TERM_LOG_STAMPS];	//arrival time of bytes from
+	long long stamp_ms[TERM_LOG_STAMPS];	//stamp_pos on, in ms since 1970
+	std::atomic<unsigned> stamp_head, stamp_tail;
+	std::atomic<bool> on;
+	std::atomic<bool> idle;	//writer is waiting for data
+	bool stop;
+	std::atomic<int> sync_secs;	//fsync every sync_secs, 0 for never
+	std::atomic<bool> stamp;	//prefix each line with its local time
+	std::atomic<int> rotate_size;	//new file after this many bytes,
+	std::atomic<int> rotate_secs;	//or this many seconds, 0 for never
+	std::atomic<bool> gzip;		//compress files rotated out
+	long long file_ms;	//when the current file was started
+	long long file_size;
+	long long index_sec;	//second of the last index entry
+	std::mutex mtx;		//only used to sleep and wake up
+	std::condition_variable cv;
+	std::thread writer;
+	std::thread packer;	//compressing the last file rotated out
+	void run();
+	bool file_open();
+	void file_close(long long ms);
+	void put_line(const char *p, int n, long long ms);
+	static void pack(char *fn);
+
+public:
+	Fl_Term_Log();
+	~Fl_Term_Log();
+	bool open(const char *fn);
+	void close();
+	bool active() { return on; }
+	void write(const char *buf, int len);
+	void sync(int secs) { sync_secs = secs>0 ? secs : 0; }
+	void stamps(bool on) { stamp = on; }
+	void rotate(int size, int secs, bool compress)
+	{
+		rotate_size = size>0 ? size : 0;
+		rotate_secs = secs>0 ? secs : 0;
+		gzip = compress;
+	}
+	unsigned lag() { return head-tail; }	//bytes not written yet
+	unsigned lost() { return dropped; }		//bytes dropped when ring was full
+};
+
+//prompts and expected strings compiled into one Aho-Corasick automaton,
+//fed each byte once as it is appended. Bytes not in any pattern share
+//class 0, so each state only needs a row as wide as the pattern alphabet.
+//Prompts count when the text so far ends with one, others when seen
+class Fl_Term_Expect {
+	char text[TERM_EXPECT_LEN*3];	//prompts, expected and pagers, each ended by 0
+	int used;
+	int at[TERM_EXPECT_MAX];	//offset of each pattern in text
+	int cnt;
+	int lost;			//patterns over TERM_EXPECT_MAX, not added
+	unsigned char cls[256];	//class of each byte
+	int ncls;
+	short *next;		//next state, by state*ncls+class
+	unsigned *out;		//patterns ending at each state, as bits
+	int state;
+
+public:
+	unsigned prompts;	//bits of the patterns that are prompts
+	unsigned pagers;	//and of those answered with a space
+	Fl_Term_Expect();
+	~Fl_Term_Expect() { free(next); free(out); }
+	void clear() { used = cnt = lost = 0; prompts = pagers = 0; }
+	unsigned add(const char *list);	//patterns separated by |, returns their bits
+	void build();
+	bool ready() { return next!=NULL; }
+	void reset() { state = 0; }
+	unsigned step(unsigned char c)	//patterns the text ends with after c
+	{
+		state = next[state*ncls+cls[c]];
+		return out[state];
+	}
+	unsigned found() { return out[state]; }
+	int count() { return cnt; }
+	int dropped() { return lost; }
+	const char *pattern(int i) { return i>=0 && i<cnt ? text+at[i] : ""; }
+};
+
+//text of the scroll buffer handed out without a copy, as pieces of the
+//chunks holding it. Each chunk stays allocated until term_unpin(), even
+//when scrolled out. Text still on screen may be overwritten by the host,
+//so that part is copied, and is the last piece
+struct Fl_Term_Pin {
+	int cnt;			//number of pieces
+	int size;			//bytes in all pieces, -1 when nothing was pinned
+	const char **chunk;	//referenced chunk of each piece, NULL for the copy
+	const char **text;	//start of each piece in its chunk
+	int *len;
+	char *copy;			//text from the screen on
+};
+void term_unpin(Fl_Term_Pin *pin);
+void term_pin_own(Fl_Term_Pin *pin, char *text, int len);
+
+//scroll buffer, cursor, escape sequence parser and modes, nothing in here
+//draws or needs a display. The view on top is told about changes through
+//the virtual functions below, and holds lock() while it reads the buffer
+class Fl_Term_Core {
+protected:
+	char c_attr;		//current character attribute(color)
+	char save_attr;		//saved character attribute, used with save_x/save_y
+	Fl_Term_Ring<char, TERM_CHUNK_BITS> buff;	//characters, one byte per char
+	Fl_Term_Attr attr;	//attributes, as runs of the same attribute
+	Fl_Term_Ring<int, TERM_LINES_BITS> line;	//starting position of each line
+	int scroll_lines;	//scrollback depth in lines
+	std::atomic<int> line_first;	//oldest line still kept in scroll buffer
+	int line_freed;		//line chunks below this one are unmapped
+	int line_top;		//lines are mapped and zeroed up to line_top
+	std::atomic<int> buff_first;	//position of the oldest chunk kept
+	int buff_freed;		//chunks of buff and attr below this are unmapped
+	int buff_top;		//chunks of buff and attr are mapped up to buff_top
+	int buff_cold;		//chunks below buff_cold are frozen when not in use
+	int thaw_low;		//lowest chunk thawed below buff_cold since frozen
+	bool bReclaim;		//more_room() left chunks for reclaim() to free
+	unsigned char **grams;	//byte pairs in each frozen chunk, for find()
+	int gram_mask;
+	int *hits;			//start and end of each match to highlight, in pairs
+	int hit_cnt;
+	int hit_room;
+	std::atomic<int> srch_shift;	//rebased by this much since regex snapshot
+	int save_line;		//next line to save, save_last is the last one
+	int save_last;
+	int size_x; 		//screen width in number of characters
+	int size_y;			//screen height in number of characters
+	int cursor_x;		//index to buff and attr for current insert position
+	int	cursor_y;		//index to line buffer for current row of text
+	int save_x;			//save_x/save_y also used to save and restore cursor
+	int save_y;			//previous cursor_y when switch to alternate screen
+	int screen_y;		//the line at top of screen
+	int roll_top;
+	int roll_bot;		//the range of lines that will scroll in alterscreen
+	int sel_left;
+	int sel_right;		//begin and end of selection in scroll buffer
+	std::atomic<bool> redraw_pending;
+	unsigned row_touched[TERM_DIRTY_ROWS/32];	//rows changed in this slice,
+	bool touched;		//published to row_dirty when the slice ends
+	int touch_y;		//row touch_span() found last
+	std::atomic<unsigned> row_dirty[TERM_DIRTY_ROWS/32];	//not drawn since
+	std::mutex append_mtx;
+	std::recursive_mutex buff_mtx;	//lock() unless the view overrides it
+
+	bool bEscape;		//escape sequence processing mode
+	int ESC_idx;		//number of bytes in the current escape sequence
+	int ESC_state;		//escape sequence parser state
+	char ESC_priv;		//private marker of ESC[, or first byte after ESC]
+	int ESC_argc;		//number of parameters of ESC[
+	int ESC_args[16];	//parameters of ESC[, -1 when not given
+	char tabstops[256];
+
+	bool bInsert;		//insert mode, for inline editing for commands
+	bool bGraphic;		//graphic character mode, for text mode drawing
+	bool bCursor;		//display cursor or not
+	bool bAppCursor;	//app cursor mode for vi
+	bool bAltScreen;	//alternative screen for vi
+	bool bBracket;		//bracketed paste mode
+	bool bWraparound;
+	bool bOriginMode;
+	bool bEcho;			//if local echo is active
+
+	int bTitle;			//title mode, changed through escape sequence
+	int title_idx;
+	char sTitle[256];	//window title set by host
+
+	char sPrompt[TERM_EXPECT_LEN];	//wait for one of these, separated by |,
+	char sExpect[TERM_EXPECT_LEN];	//or one of these before next command
+	char sPager[TERM_EXPECT_LEN];	//pager prompts answered with a space
+	Fl_Term_Expect expect;	//both compiled, fed by append()
+	std::mutex expect_mtx;	//guards expect while a script rebuilds it
+	std::atomic<int> expect_mark;	//cursor_x at mark_prompt(), -1 if taken
+	int expect_pos;		//buff scanned by expect up to here
+	int iMatch;			//pattern that ended the last wait, -1 if none
+	int *pager_hits;	//where each pager prompt was answered, the pattern
+	int pager_cnt;		//and the start of its row, since mark_prompt()
+	int pager_room;
+	std::atomic<bool> bPrompt;	//if a prompt was found after the last append
+	std::mutex prompt_mtx;	//guards bPrompt for waiters
+	std::condition_variable prompt_cv;	//notified as soon as sPrompt is found
+	std::atomic<long long> recv_ns;	//steady clock when text last arrived
+	int recv0;			//cursor_x at the start of last command
+	int xmlIndent;		//used by putxml
+	int xmlTagIsOpen;	//used by putxml
+
+	char *LogFileName;
+	Fl_Term_Log logger;
+
+	virtual void bell() {}		//BEL received
+	virtual void notify() {}	//title or screen size changed by the host
+	virtual void answer(const char *, int) {}	//reply to the host
+	virtual void wake() {}		//first change since pending(false)
+
+	void touch(int y)
+	{
+		unsigned b = y&(TERM_DIRTY_ROWS-1);
+		row_touched[b>>5] |= 1u<<(b&31);
+		touched = true;
+	}
+	void touch_rows(int y, int n) { for ( int i=0; i<n; i++ ) touch(y+i); }
+	void touch_span(int from, int len);
+	void touch_flush();
+	void next_line();
+	void more_room();
+	void reclaim();
+	void reset();
+	void append_slice(const unsigned char *p, const unsigned char *zz);
+	void thaw(int from, int len);
+	bool srch_chunk(int i, char *dst);
+	void buff_clear(int offset, int len);
+	void buff_copy(int to, int from, int len);
+	void termsize(int cols, int rows);
+	void screen_clear(int m0);
+	void check_cursor_y();
+	void gram_build(int i);
+	bool gram_skip(int i, const char *up, int l);
+	int find(const char *up, int l, int from, int to, bool back);
+	const unsigned char *vt100_Escape(const unsigned char *buf, int cnt);
+	void expect_build();
+	void matched(char *buf, int size);
+	void expect_scan();
+	void pager_hit(int match);
+	bool paged();
+	int pager_strip(char *p, int from, int len);
+	void prompt_found(int match);
+	void vt100_ctrl(unsigned char c);
+	void vt100_esc(unsigned char c);
+	void vt100_csi(unsigned char c);
+	const unsigned char *telnet_options(const unsigned char *buf, int cnt);
+
+public:
+	Fl_Term_Core(int cols, int rows);
+	virtual ~Fl_Term_Core();
+	virtual void clear();
+	void append(const char *buf, int len);
+	void put_xml(const char *buf, int len);
+	int pin(int from, int len, Fl_Term_Pin *out);
+	void disp(const char *buf) { append(buf, strlen(buf)); }
+	virtual void lock() { buff_mtx.lock(); }	//held while the buffer changes
+	virtual void unlock() { buff_mtx.unlock(); }
+	bool pending(){ return redraw_pending; }
+	bool dirty(int y)	//takes the bit of line y, call before reading it
+	{
+		unsigned b = y&(TERM_DIRTY_ROWS-1), m = 1u<<(b&31);
+		return (row_dirty[b>>5].fetch_and(~m)&m)!=0;
+	}
+	void pending(bool p)	//calls wake() once until the view draws again
+	{
+		if ( !p ) redraw_pending = false;
+		else if ( !redraw_pending.exchange(true) ) wake();
+	}
+	const char *title() { return sTitle; }
+	int sizeX() { return size_x; }
+	int sizeY() { return size_y; }
+	int scrollback() { return scroll_lines; }
+	void scrollback(int lines);
+	char *logg() { return LogFileName; }
+	void logg(const char *fn);
+	void logg_sync(int secs) { logger.sync(secs); }
+	void logg_stamp(bool on) { logger.stamps(on); }
+	void logg_rotate(int size, int secs, bool gzip)
+	{
+		logger.rotate(size, secs, gzip);
+	}
+	unsigned logg_lag() { return logger.lag(); }
+	unsigned logg_lost() { return logger.lost(); }
+};
+#endif
@@ -33,13 +33,94 @@
 #include "host.h"
 using namespace std;
 
+HOST::~HOST()
+{//a plain HOST has nothing else host_cb could reach
+	stop(false);
+	free(rx_buf);
+}
+//end the parser before delete, after parsing what is queued if drain,
+//caller must not hold anything host_cb waits for, i.e. the FLTK lock.
+//Every derived destructor calls it first, while the members that host_cb
+//may reach through write(), type() or queued() are still there
+void HOST::stop(bool drain)
+{
+	if ( !parser.joinable() ) return;
+	if ( drain ) rx_wait(0);
+	rx_mtx.lock();
+	rx_stop = true;
+	rx_mtx.unlock();
+	rx_cv.notify_all();
+	parser.join();
+}
 void HOST::connect()
 {
+	if ( rx_buf==NULL ) rx_buf = (char *)malloc(HOST_RX_SIZE);
+	if ( !parser.joinable() ) {
+		rx_stop = false;
+		std::thread new_parser(&HOST::parse, this);
+		parser.swap(new_parser);
+		rx_on = true;
+	}
 	if ( !reader.joinable() ) {
-		std::thread new_reader(&HOST::read, this);
+		std::thread new_reader(&HOST::run, this);
 		reader.swap(new_reader);
 	}
 }
+void HOST::run()
+{
+	read();		//host may be deleted once read() detaches the reader
+}
+void HOST::parse()
+{
+	rx_parser = std::this_thread::get_id();
+	while ( !rx_stop ) {
+		unsigned tail = rx_tail;
+		unsigned n = rx_head-tail;
+		if ( n==0 ) {
+			std::unique_lock<std::mutex> lck(rx_mtx);
+			rx_idle = true;
+			rx_cv.wait(lck, [this]{ return rx_head!=rx_tail || rx_stop; });
+			rx_idle = false;
+			if ( rx_stop ) return;
+			continue;
+		}
+		unsigned t = tail&(HOST_RX_SIZE-1);
+		if ( n>HOST_RX_SIZE-t ) n = HOST_RX_SIZE-t;
+		host_cb(host_data_, rx_buf+t, n);	//everything up to the wrap
+		rx_tail = tail+n;
+		if ( rx_full ) {
+			std::lock_guard<std::mutex> lck(rx_mtx);
+			rx_cv.notify_all();
+		}
+	}
+}
+void HOST::rx_wait(unsigned level)
+{//wait until no more than level bytes are left unparsed
+	if ( rx_head-rx_tail<=level ) return;
+	std::unique_lock<std::mutex> lck(rx_mtx);
+	rx_full++;
+	rx_cv.wait(lck, [this,level]{ return rx_head-rx_tail<=level||rx_stop; });
+	rx_full--;
+}
+void HOST::rx_push(const char *buf, int len)
+{
+	while ( len>0 ) {
+		unsigned n = len<HOST_RX_CHUNK ? len : HOST_RX_CHUNK;
+		rx_wait(HOST_RX_HIGH-n);	//backpressure, socket stops being read
+		unsigned head = rx_head;
+		unsigned h = head&(HOST_RX_SIZE-1);
+		unsigned n1 = n<HOST_RX_SIZE-h ? n : HOST_RX_SIZE-h;
+		memcpy(rx_buf+h, buf, n1);
+		memcpy(rx_buf, buf+n1, n-n1);
+		rx_head = head+n;
+		if ( rx_idle ) {
+			std::lock_guard<std::mutex> lck(rx_mtx);
+			rx_cv.notify_all();
+		}
+		buf += n;
+		len -= n;
+	}
+}
 void HOST::print(const char *fmt, ...)
 {
 	char buff[4096];
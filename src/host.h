@@ -35,6 +35,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 #ifndef _HOST_H_
 #define _HOST_H_
@@ -45,6 +48,10 @@ enum {  HOST_IDLE=0, HOST_CONNECTING, HOST_AUTHENTICATING, HOST_CONNECTED };
 typedef void ( host_callback )(void *, const char *, int);
 typedef char *(host_callback1)(void *, const char *, bool);
 
+#define HOST_RX_SIZE	(1<<20)		//bytes received but not yet parsed
+#define HOST_RX_HIGH	(HOST_RX_SIZE-(HOST_RX_SIZE>>2))	//reader waits above
+#define HOST_RX_CHUNK	65536		//largest push at a time
+
 class HOST {
 protected:
 	int state;
@@ -53,6 +60,27 @@ protected:
 	host_callback1 *host_cb1;
 	std::thread reader;
 
+	//ring of received text, pushed at rx_head by the reader, and by other
+	//threads with output like tunnels and scp, taking turns on rx_in_mtx.
+	//The parser thread drains from rx_tail and calls host_cb in large
+	//batches, so it is the only thread appending text once it runs
+	char *rx_buf;
+	std::atomic<unsigned> rx_head, rx_tail;
+	std::atomic<bool> rx_on;	//parser started, text goes through the ring
+	std::atomic<bool> rx_idle;	//parser is waiting for data
+	std::atomic<int> rx_full;	//threads waiting for room or for the parser
+	std::atomic<bool> rx_stop;	//parser drops what is left and ends
+	std::mutex rx_mtx;			//only used to sleep and wake up
+	std::condition_variable rx_cv;
+	std::mutex rx_in_mtx;		//one thread pushes at a time
+	std::atomic<std::thread::id> rx_parser;
+	std::thread parser;
+	void run();
+	void parse();
+	void rx_push(const char *buf, int len);
+	void rx_wait(unsigned level);
+	bool on_parser() { return std::this_thread::get_id()==rx_parser; }
+
 public:
 	HOST()
 	{
@@ -60,8 +88,13 @@ public:
 		host_cb1 = NULL;
 		host_data_ = NULL;
 		state = HOST_IDLE;
+		rx_buf = NULL;
+		rx_head = rx_tail = 0;
+		rx_on = rx_idle = rx_stop = false;
+		rx_full = 0;
+		rx_parser = std::thread::id();	//no thread yet
 	}
-	virtual ~HOST(){}
+	virtual ~HOST();
 	virtual	void connect();
 	virtual const char *name()	{ return ""; }
 	virtual int type()			{ return HOST_NULL; }
@@ -79,14 +112,27 @@ public:
 		host_data_ = data;
 	}
 	void term_puts(const char *buf, int len)
-	{
-		host_cb(host_data_, buf, len);
+	{//text in the order it came from any thread, status after all before it
+		if ( !rx_on || on_parser() ) {	//nothing to keep in order with
+			host_cb(host_data_, buf, len);
+			return;
+		}
+		std::lock_guard<std::mutex> lck(rx_in_mtx);
+		if ( len>0 ) 
+			rx_push(buf, len);	//never waits for the parser below high-water
+		else {
+			rx_wait(0);
+			if ( !rx_stop ) host_cb(host_data_, buf, len);
+		}
 	}
 	char *term_gets(const char *prompt, int echo)
 	{
+		if ( rx_on && !on_parser() ) rx_wait(0);
 		return host_cb1(host_data_, prompt, echo);
 	}
+	void stop(bool drain);
 	int live() { return reader.joinable(); }
+	unsigned queued() { return rx_head-rx_tail; }	//received, not parsed yet
 	int status() { return state; }
 	void status(int s) { state = s; }
 	void print(const char *fmt, ...);
@@ -115,6 +161,7 @@ private:
 
 public:
 	comHost(const char *address);
+	~comHost() { stop(false); }
 
 //	virtual void connect();
 	virtual const char *name() { return portname+4; }
@@ -140,7 +187,7 @@ private:
 #endif
 public:
 	pipeHost(const char *name);
-	~pipeHost(){}
+	~pipeHost() { stop(false); }
 
 //	virtual void connect();
 	virtual const char *name(){ return cmdline; }
@@ -160,7 +207,7 @@ protected:
 
 public:
 	tcpHost(const char *name);
-	~tcpHost(){}
+	~tcpHost() { stop(false); }
 
 //	virtual void connect();
 	virtual const char *name(){ return hostname; }
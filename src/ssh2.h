@@ -73,6 +73,7 @@ protected:
 
 public:
 	sshHost(const char *name);
+	~sshHost() { stop(false); }
 
 //	virtual const char *name();
 //	virtual void connect();
@@ -108,6 +109,7 @@ protected:
 
 public:
 	sftpHost(const char *name) : sshHost(name) {}
+	~sftpHost() { stop(false); }
 //	virtual const char *name();
 //	virtual void connect();					//from sshHost
 	virtual int type() { return HOST_SFTP; }
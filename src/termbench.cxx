@@ -0,0 +1,265 @@
+//
+// termbench -- parser throughput benchmark for Fl_Term_Core
+//
+//	feeds corpora through append(), vt100_Escape() and put_xml() the way
+//	the parser thread does, and reports MB/s, ns/byte and allocations/MB,
+//	the last one only when built with -DBENCH_ALLOCS
+//
+// This library is free software distributed under GNU GPL 3.0,
+// see the license at:
+//
+//     https://github.com/yongchaofan/tinyTerm2/blob/master/LICENSE
+//
+// Please report all bugs and problems on the following page:
+//
+//     https://github.com/yongchaofan/tinyTerm2/issues/new
+//
+//	usage: termbench [-m MB] [file ...]
+//	without files, built in corpora are generated: plain ASCII flood, heavy
+//	SGR color, cursor addressed full screen, UTF-8 CJK and NETCONF XML.
+//	Files ending in .xml go through put_xml(), others through append()
+//
+#include "Fl_Term_Core.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define BENCH_CHUNK	65536	//bytes handed to the parser at a time, like HOST
+
+//with -DBENCH_ALLOCS every malloc, calloc and realloc is counted, new goes
+//through malloc too. This replaces the glibc allocator entry points, so it
+//is left out of normal builds, and of sanitizer or other allocator builds
+#if defined(BENCH_ALLOCS) && defined(__GLIBC__)
+#define BENCH_COUNTING
+static std::atomic<long long> allocs(0);
+extern "C" {
+void *__libc_malloc(size_t n);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *p, size_t n);
+void *malloc(size_t n) { allocs++; return __libc_malloc(n); }
+void *calloc(size_t n, size_t size) { allocs++; return __libc_calloc(n, size); }
+void *realloc(void *p, size_t n) { allocs++; return __libc_realloc(p, n); }
+}
+#endif
+
+enum { BENCH_APPEND, BENCH_ESCAPE, BENCH_XML };
+
+//the parser entry points are protected, a subclass gets to call them
+class Bench_Term : public Fl_Term_Core {
+public:
+	Bench_Term() : Fl_Term_Core(80, 25) {}
+	void feed(const char *buf, int len, int how)
+	{
+		if ( how==BENCH_XML )
+			put_xml(buf, len);
+		else if ( how==BENCH_APPEND )
+			append(buf, len);
+		else {				//sequences only, ESC is skipped like append() does
+			const unsigned char *p = (const unsigned char *)buf;
+			const unsigned char *zz = p+len;
+			while ( p<zz ) {
+				if ( *p++!=0x1b ) continue;
+				p = vt100_Escape(p, zz-p);
+			}
+		}
+	}
+};
+
+//corpora are made from a fixed seed, so every run measures the same bytes
+static unsigned int seed;
+static int rnd(int n)
+{
+	seed = seed*1103515245+12345;
+	return (seed>>16)%n;
+}
+static const char *words[] = { "interface", "GigabitEthernet0/0/1", "up",
+	"down", "description", "uplink", "to", "core", "ip", "address", "10.0.0.1",
+	"255.255.255.0", "shutdown", "!", "router", "ospf", "1", "network",
+	"area", "0", "input", "errors", "CRC", "frame", "overrun", "packets" };
+static int word(char *p)
+{
+	const char *w = words[rnd(sizeof(words)/sizeof(words[0]))];
+	int n = strlen(w);
+	memcpy(p, w, n);
+	return n;
+}
+static int gen_plain(char *buf, int size)
+{//log lines of up to 78 characters
+	char *p = buf, *zz = buf+size-128;
+	while ( p<zz ) {
+		int l = 0;
+		while ( l<60 ) {
+			l += word(p+l);
+			p[l++] = ' ';
+		}
+		p[l++] = '\r';
+		p[l++] = '\n';
+		p += l;
+	}
+	return p-buf;
+}
+static int gen_sgr(char *buf, int size)
+{//ls --color and compiler output, every word in its own colors
+	char *p = buf, *zz = buf+size-512;
+	while ( p<zz ) {
+		for ( int i=0; i<8; i++ ) {
+			p += sprintf(p, "\033[%d;%d;%dm", rnd(2), 30+rnd(8), 40+rnd(8));
+			p += word(p);
+			p += sprintf(p, rnd(4)==0 ? "\033[m " : "\033[0m ");
+		}
+		p += sprintf(p, "\033[1;3%dm%d\033[39;49m\r\n", rnd(8), rnd(100000));
+	}
+	return p-buf;
+}
+static int gen_screen(char *buf, int size)
+{//top and vi, whole screens redrawn by cursor addressing
+	char *p = buf, *zz = buf+size-4096;
+	p += sprintf(p, "\033[?1049h\033[1;25r");
+	while ( p<zz ) {
+		p += sprintf(p, "\033[H\033[7m%-80.80s\033[27m", " PID USER  %CPU");
+		for ( int y=2; y<=24; y++ ) {
+			p += sprintf(p, "\033[%d;1H%5d root  %2d.%d ", y, rnd(32768),
+													rnd(100), rnd(10));
+			for ( int i=0; i<4; i++ ) {
+				p += word(p);
+				*p++ = ' ';
+			}
+			p += sprintf(p, "\033[K");
+		}
+		p += sprintf(p, "\033[25;1H\033[1;33m-- INSERT --\033[0m\033[%d;%dH",
+												rnd(24)+1, rnd(80)+1);
+		if ( rnd(8)==0 ) p += sprintf(p, "\033[2J");
+		if ( rnd(4)==0 ) p += sprintf(p, "\033[5;20r\033[5;1H\033[3M\033[1;25r");
+	}
+	p += sprintf(p, "\033[?1049l");
+	return p-buf;
+}
+static int gen_cjk(char *buf, int size)
+{//UTF-8 text, three byte CJK characters mixed with ASCII
+	char *p = buf, *zz = buf+size-1024;
+	while ( p<zz ) {
+		for ( int i=0; i<30; i++ ) {
+			if ( rnd(5)==0 ) {
+				p += word(p);
+				*p++ = ' ';
+				continue;
+			}
+			int u = 0x4e00+rnd(0x5000);
+			*p++ = 0xe0|(u>>12);
+			*p++ = 0x80|((u>>6)&0x3f);
+			*p++ = 0x80|(u&0x3f);
+		}
+		*p++ = '\r';
+		*p++ = '\n';
+	}
+	return p-buf;
+}
+static int gen_escape(char *buf, int size)
+{//escape sequences only, for vt100_Escape() by itself
+	char *p = buf, *zz = buf+size-64;
+	while ( p<zz ) switch ( rnd(6) ) {
+		case 0: p += sprintf(p, "\033[%d;%dm", rnd(2), 30+rnd(8)); break;
+		case 1: p += sprintf(p, "\033[%d;%dH", rnd(24)+1, rnd(80)+1); break;
+		case 2: p += sprintf(p, "\033[K"); break;
+		case 3: p += sprintf(p, "\033[%dC", rnd(10)+1); break;
+		case 4: p += sprintf(p, "\033[?25%c", rnd(2) ? 'h' : 'l'); break;
+		case 5: p += sprintf(p, "\0337\033[%dX\0338", rnd(8)+1); break;
+	}
+	return p-buf;
+}
+static int gen_xml(char *buf, int size)
+{//NETCONF replies, one interface per element, ]]>]]> between messages
+	char *p = buf, *zz = buf+size-1024;
+	int id = 100;
+	while ( p<zz ) {
+		p += sprintf(p, "<rpc-reply xmlns=\"urn:ietf:params:xml:ns:netconf:"
+						"base:1.0\" message-id=\"%d\"><data><interfaces>", id++);
+		for ( int i=0; i<8 && p<zz; i++ )
+			p += sprintf(p, "<interface><name>ge-0/0/%d</name><enabled>%s"
+						"</enabled><mtu>%d</mtu><description>to core %d"
+						"</description></interface>", rnd(48),
+						rnd(2) ? "true" : "false", 1500+rnd(8000), rnd(100));
+		p += sprintf(p, "</interfaces></data></rpc-reply>]]>]]>");
+	}
+	return p-buf;
+}
+
+static void bench(const char *name, const char *buf, int len, int how,
+					long long total)
+{
+	Bench_Term *term = new Bench_Term();
+	term->feed(buf, len<BENCH_CHUNK ? len : BENCH_CHUNK, how);	//warm up
+#ifdef BENCH_COUNTING
+	long long a0 = allocs;
+#endif
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	long long done = 0;
+	while ( done<total ) {			//in the chunks the parser thread hands out
+		for ( int i=0; i<len && done<total; i+=BENCH_CHUNK ) {
+			int n = len-i<BENCH_CHUNK ? len-i : BENCH_CHUNK;
+			term->feed(buf+i, n, how);
+			done += n;
+		}
+	}
+	double secs = std::chrono::duration<double>(
+							std::chrono::steady_clock::now()-t0).count();
+#ifdef BENCH_COUNTING
+	long long a = allocs-a0;
+	printf("%-16s %10.1f %10.2f %12.1f\n", name, done/secs/1048576,
+								secs*1e9/done, a*1048576.0/done);
+#else
+	printf("%-16s %10.1f %10.2f %12s\n", name, done/secs/1048576,
+								secs*1e9/done, "-");
+#endif
+	delete term;
+}
+
+int main(int argc, char **argv)
+{
+	long long total = 256LL<<20;	//bytes parsed for each corpus
+	int i = 1;
+	if ( argc>2 && strcmp(argv[1], "-m")==0 ) {
+		total = atoll(argv[2])<<20;
+		i = 3;
+	}
+	if ( total<=0 ) {
+		fprintf(stderr, "usage: termbench [-m MB] [file ...]\n");
+		return 1;
+	}
+	int size = 16<<20;
+	char *buf = (char *)malloc(size);
+	if ( buf==NULL ) return 1;
+	printf("%-16s %10s %10s %12s\n", "corpus", "MB/s", "ns/byte", "allocs/MB");
+	if ( i==argc ) {
+		struct { const char *name; int (*gen)(char *, int); int how; } corp[] = {
+			{ "plain",  gen_plain,  BENCH_APPEND },
+			{ "sgr",    gen_sgr,    BENCH_APPEND },
+			{ "screen", gen_screen, BENCH_APPEND },
+			{ "cjk",    gen_cjk,    BENCH_APPEND },
+			{ "escape", gen_escape, BENCH_ESCAPE },
+			{ "netconf",gen_xml,    BENCH_XML } };
+		for ( unsigned int k=0; k<sizeof(corp)/sizeof(corp[0]); k++ ) {
+			seed = 1;
+			int len = corp[k].gen(buf, size);
+			bench(corp[k].name, buf, len, corp[k].how, total);
+		}
+	}
+	for ( ; i<argc; i++ ) {			//recorded sessions, as logged by logg()
+		FILE *fp = fopen(argv[i], "rb");
+		if ( fp==NULL ) {
+			fprintf(stderr, "can't open %s\n", argv[i]);
+			continue;
+		}
+		int len = fread(buf, 1, size, fp);
+		fclose(fp);
+		if ( len<=0 ) continue;
+		const char *name = strrchr(argv[i], '/');
+		name = name==NULL ? argv[i] : name+1;
+		const char *ext = strrchr(name, '.');
+		bench(name, buf, len, ext!=NULL && strcasecmp(ext, ".xml")==0 ?
+				BENCH_XML : BENCH_APPEND, total);
+	}
+	free(buf);
+	return 0;
+}
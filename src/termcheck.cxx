@@ -0,0 +1,448 @@
+//
+// termcheck -- self-check of Fl_Term_Core, no display needed
+//
+//	feeds fixed input through the core and compares the screen, attributes
+//	and other results with what they should be, covering the parser, the
+//	run length attributes, the chunk ring, expect, pager strip and the log
+//
+// This library is free software distributed under GNU GPL 3.0,
+// see the license at:
+//
+//     https://github.com/yongchaofan/tinyTerm2/blob/master/LICENSE
+//
+// Please report all bugs and problems on the following page:
+//
+//     https://github.com/yongchaofan/tinyTerm2/issues/new
+//
+//	usage: termcheck [-v]
+//	prints each check that fails, and a count at the end, -v prints those
+//	that pass as well. Exits with 1 when any check failed. The log check
+//	writes termcheck.log and its rotated files in the current directory,
+//	and removes them again
+//
+#include "Fl_Term_Core.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef WIN32
+#include <io.h>
+#define access _access
+#else
+#include <unistd.h>
+#endif
+
+static int checks, failed;
+static bool verbose;
+
+static void check(bool ok, const char *what)
+{
+	checks++;
+	if ( !ok ) failed++;
+	if ( !ok || verbose ) printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+}
+static void check_str(const char *got, const char *want, const char *what)
+{
+	bool ok = strcmp(got, want)==0;
+	check(ok, what);
+	if ( !ok ) printf("\tgot  \"%s\"\n\twant \"%s\"\n", got, want);
+}
+static void check_int(int got, int want, const char *what)
+{
+	check(got==want, what);
+	if ( got!=want ) printf("\tgot  %d\n\twant %d\n", got, want);
+}
+
+//the parser and the buffer are protected, a subclass gets to them
+class Check_Term : public Fl_Term_Core {
+	char text[1024];
+public:
+	int spaces;			//pager prompts answered
+	Check_Term() : Fl_Term_Core(80, 25) { spaces = 0; }
+	void answer(const char *buf, int len)
+	{
+		if ( len==1 && *buf==' ' ) spaces++;
+	}
+	void put(const char *s) { append(s, strlen(s)); }
+	const char *row(int y)	//screen row y, without blanks at the end
+	{
+		int a = line[screen_y+y], n = line[screen_y+y+1]-a;
+		if ( n<0 ) n = 0;
+		if ( n>(int)sizeof(text)-1 ) n = sizeof(text)-1;
+		buff.get(text, a, n);
+		while ( n>0 && (text[n-1]==' ' || text[n-1]==0x0a) ) n--;
+		text[n] = 0;
+		return text;
+	}
+	int attr_at(int y, int x) { return (unsigned char)attr.get(line[screen_y+y]+x); }
+	int col() { return cursor_x-line[cursor_y]; }
+	int top() { return cursor_y-screen_y; }
+	bool alt() { return bAltScreen; }
+	void patterns(const char *prompt, const char *exp, const char *pager)
+	{
+		strcpy(sPrompt, prompt);
+		strcpy(sExpect, exp);
+		strcpy(sPager, pager);
+		expect_build();
+	}
+	void mark()			//what Fl_Term::mark_prompt() does
+	{
+		expect_mark = cursor_x;
+		std::lock_guard<std::mutex> lck(prompt_mtx);
+		bPrompt = false;
+		iMatch = -1;
+		recv0 = cursor_x;
+	}
+	bool found() { return bPrompt; }
+	const char *match() { matched(text, sizeof(text)); return text; }
+	int reply(char *buf, int size)	//what a command got back, pagers cut out
+	{
+		int len = cursor_x-recv0;
+		if ( len>size ) len = size;
+		thaw(recv0, len);
+		buff.get(buf, recv0, len);
+		return paged() ? pager_strip(buf, recv0, len) : len;
+	}
+	int line_at(int y) { return line[y]; }
+	bool frozen(int i) { return buff.frozen(i); }
+};
+
+static void check_text()
+{
+	Check_Term t;
+	t.put("hello\r\nworld");
+	check_str(t.row(0), "hello", "text: first row");
+	check_str(t.row(1), "world", "text: second row");
+	check_int(t.col(), 5, "text: cursor column");
+	t.put("\r\na\tb\tc");
+	check_str(t.row(2), "a       b       c", "text: tab stops every 8");
+	t.put("\r\n");
+	for ( int i=0; i<85; i++ ) t.put(i<80 ? "x" : "y");
+	check_str(t.row(4), "yyyyy", "text: wraps at 80 columns");
+	t.put("\r\nabc\bd\b\bZ");
+	check_str(t.row(5), "aZd", "text: backspace");
+}
+
+static void check_sgr()
+{
+	Check_Term t;
+	t.put("a\033[31mb\033[1mc\033[0md\033[7me\033[m\033[44mf\033[93;49mg\033[39mh");
+	check_str(t.row(0), "abcdefgh", "sgr: text");
+	int want[8] = { 7, 0x01, 0x09, 7, 0x70, 0x47, 0x0b, 0x0f };
+	char what[64];
+	for ( int x=0; x<8; x++ ) {
+		snprintf(what, sizeof(what), "sgr: attribute of '%c'", 'a'+x);
+		check_int(t.attr_at(0, x), want[x], what);
+	}
+}
+
+static void check_cursor()
+{
+	Check_Term t;
+	t.put("\033[2J\033[3;5Hab\033[1;1Hxyz");
+	check_str(t.row(2), "    ab", "cursor: CUP row 3 column 5");
+	check_str(t.row(0), "xyz", "cursor: CUP home");
+	check_int(t.top()*100+t.col(), 3, "cursor: position after xyz");
+	t.put("\033[3;3H\033[K");
+	check_str(t.row(2), "", "cursor: EL erases to end of row");
+	t.put("\033[1;1H0123456789\033[1;3H\033[2P");
+	check_str(t.row(0), "01456789", "cursor: DCH deletes two");
+	t.put("\033[2@");
+	check_str(t.row(0), "01  456789", "cursor: ICH inserts two");
+	t.put("\033[2;1H\033[31mRED\033[mplain\033[2;1H\033[1P");
+	check_str(t.row(1), "EDplain", "cursor: DCH on colored text");
+	check_int(t.attr_at(1, 1), 0x01, "cursor: colors move with DCH");
+	check_int(t.attr_at(1, 2), 7, "cursor: plain text moves with DCH");
+}
+
+static void check_scroll()
+{
+	Check_Term t;
+	t.put("main\r\n\033[?1049h\033[2J\033[H1\r\n2\r\n3\r\n4\r\n5");
+	check(t.alt(), "scroll: alternate screen on");
+	t.put("\033[2;4r\033[4;1H\n");
+	check_str(t.row(0), "1", "scroll: row above region kept");
+	check_str(t.row(1), "3", "scroll: region scrolled up");
+	check_str(t.row(2), "4", "scroll: region scrolled up, last");
+	check_str(t.row(3), "", "scroll: new blank row at region bottom");
+	check_str(t.row(4), "5", "scroll: row below region kept");
+	t.put("\033[2;1H\033M");
+	check_str(t.row(1), "", "scroll: RI at region top inserts a row");
+	check_str(t.row(2), "3", "scroll: RI moves the region down");
+	t.put("\033[r\033[?1049l");
+	check(!t.alt(), "scroll: alternate screen off");
+	check_str(t.row(0), "main", "scroll: main screen back");
+}
+
+//runs of attributes against a plain array, written and moved at random
+static void check_attr()
+{
+	Fl_Term_Attr a;
+	a.slots(64);
+	static char m[20000];
+	memset(m, 0, sizeof(m));
+	unsigned int seed = 7;
+	int end = 0, bad = -1;
+	for ( int op=0; op<30000 && end<18000 && bad<0; op++ ) {
+		seed = seed*1103515245+12345;
+		int r = seed>>8, base = end>300 ? end-300 : 0;
+		int i = base+r%(end-base+50), n = (r>>12)%40;
+		char v = (r>>20)%4;
+		switch ( r%4 ) {
+		case 0: a.set(end, v); m[end++] = v; break;
+		case 1: a.fill(i, v, n);
+				memset(m+i, v, n);
+				if ( end<i+n ) end = i+n;
+				break;
+		case 2: { int to = base+(r>>6)%(end-base+20);
+				a.move(to, i, n);
+				memmove(m+to, m+i, n);
+				if ( end<to+n ) end = to+n;
+				} break;
+		case 3: i = end+(r>>12)%5;
+				a.set(i, v); m[i] = v; end = i+1;
+				break;
+		}
+		for ( int j=base; j<end+8 && bad<0; j++ )
+			if ( a.get(j)!=m[j] ) bad = j;
+	}
+	check(bad<0, "attr: runs match a plain array after fill, move and set");
+	if ( bad>=0 ) printf("\tfirst difference at %d\n", bad);
+}
+
+static void check_ring()
+{
+	Fl_Term_Ring<char, 12> r;
+	r.slots(4);
+	char *want = (char *)malloc(4096), *got = (char *)malloc(4096);
+	for ( int i=0; i<4096; i++ ) want[i] = "tinyTerm2 "[i%10];
+	check(!r.mapped(0) && r[5]==0, "ring: unmapped slot reads zeros");
+	r.map(0);
+	r.put(0, want, 4096);
+	const char *pinned = r.pin(0);
+	r.freeze(0);
+	check(r.frozen(0) && !r.mapped(0), "ring: frozen chunk leaves its slot");
+	check(memcmp(pinned, want, 4096)==0, "ring: pinned chunk outlives freeze");
+	Fl_Term_Ring<char, 12>::unref(pinned);
+	check(r.copy(0, got) && memcmp(got, want, 4096)==0,
+										"ring: copy of a frozen chunk");
+	check(r.frozen(0), "ring: still frozen after copy");
+	check(r.thaw(0) && !r.frozen(0) && memcmp(&r[0], want, 4096)==0,
+										"ring: thaw brings the chunk back");
+	r.map(4096);
+	r.put(4096-10, want, 20);
+	r.move(4096-5, 4096-10, 20);
+	r.get(got, 4096-5, 20);
+	check(memcmp(got, want, 20)==0, "ring: move across chunks");
+	r.unmap(0);
+	check(r[100]==0, "ring: unmapped chunk reads zeros again");
+
+	char *z = term_pack(want, 4096);
+	memset(got, 0, 4096);
+	check(z!=NULL && term_unpack(z, got, 4096) && memcmp(got, want, 4096)==0,
+										"ring: pack and unpack");
+	free(z);
+	free(want);
+	free(got);
+}
+
+//old text of the scroll buffer is frozen, and thawed when read again
+static void check_freeze()
+{
+	Check_Term t;
+	char buf[64];
+	for ( int i=0; i<40000; i++ ) {
+		snprintf(buf, sizeof(buf), "line %06d of the scroll buffer\r\n", i);
+		t.put(buf);
+	}
+	int a = t.line_at(100), len = t.line_at(101)-a;
+	check(t.frozen(a), "freeze: old chunks are frozen");
+	Fl_Term_Pin pin;
+	int n = t.pin(a, len, &pin);
+	int l = 0;
+	for ( int k=0; k<pin.cnt; k++ ) {
+		memcpy(buf+l, pin.text[k], pin.len[k]);
+		l += pin.len[k];
+	}
+	buf[l] = 0;
+	term_unpin(&pin);
+	check(n==len, "freeze: pinned all of the line");
+	check_str(buf, "line 000100 of the scroll buffer\n", "freeze: thawed text");
+}
+
+//the automaton against a plain search for the patterns at each byte
+static void check_expect()
+{
+	Fl_Term_Expect e;
+	check_int(e.add("ab||c|"), 3, "expect: empty pieces skipped");
+	check_int(e.count(), 2, "expect: two patterns");
+	unsigned int seed = 1;
+	int bad = 0;
+	for ( int it=0; it<2000; it++ ) {
+		char pats[5][8], list[64] = "", txt[64];
+		e.clear();
+		seed = seed*1103515245+12345;
+		int np = 1+(seed>>16)%5;
+		for ( int k=0; k<np; k++ ) {
+			seed = seed*1103515245+12345;
+			int l = 1+(seed>>16)%4;
+			for ( int j=0; j<l; j++ ) {
+				seed = seed*1103515245+12345;
+				pats[k][j] = "abc"[(seed>>16)%3];
+			}
+			pats[k][l] = 0;
+			if ( k>0 ) strcat(list, "|");
+			strcat(list, pats[k]);
+		}
+		e.add(list);
+		e.build();
+		e.reset();
+		for ( int j=0; j<60; j++ ) {
+			seed = seed*1103515245+12345;
+			txt[j] = "abcd"[(seed>>16)%4];
+			unsigned m = e.step(txt[j]), w = 0;
+			for ( int k=0; k<np; k++ ) {
+				int l = strlen(pats[k]);
+				if ( l<=j+1 && memcmp(txt+j+1-l, pats[k], l)==0 ) w |= 1u<<k;
+			}
+			if ( m!=w ) bad++;
+		}
+	}
+	check_int(bad, 0, "expect: automaton matches a plain search");
+
+	Check_Term t;
+	t.patterns("router>|router#|(config)#", "% Invalid", "");
+	const char *cases[][4] = {
+		{ "show run\r\nline1\r\nrout", "er#", "router#" },
+		{ "conf t\r\n", "router(config)#", "(config)#" },
+		{ "x\r\n% Inv", "alid input\r\nrouter#", "% Invalid" },
+		{ "router# is here\r\n", "more", "" },
+	};
+	for ( int i=0; i<4; i++ ) {
+		t.mark();
+		t.put(cases[i][0]);
+		t.put(cases[i][1]);
+		check_str(t.found() ? t.match() : "", cases[i][2],
+								"expect: prompt or expected string found");
+	}
+}
+
+//pager prompts answered with a space, then cut out of the reply, however
+//the host erases them before the next page
+static void check_pager()
+{
+	const char *erase[] = { "\r          \r", "\b\b\b\b\b\b\b\b\b\b"
+					"          \b\b\b\b\b\b\b\b\b\b", "\r\n", "\r\033[K" };
+	char *want = (char *)malloc(65536), *got = (char *)malloc(65536);
+	for ( int e=0; e<4; e++ ) {
+		Check_Term t;
+		t.patterns("router#", "", "--More--|-- More --");
+		t.mark();
+		t.put("show run\r\n");
+		int w = sprintf(want, "show run\n");
+		for ( int page=0, lines=0; page<=20; page++ ) {
+			if ( page>0 ) t.put(erase[e]);
+			for ( int i=0; i<5; i++, lines++ ) {
+				char buf[64];
+				sprintf(buf, "%s %d", lines%3 ? "ip address" : "!", lines);
+				t.put(buf);
+				t.put("\r\n");
+				w += sprintf(want+w, "%s\n", buf);
+			}
+			t.put(page<20 ? " --More-- " : "router#");
+		}
+		w += sprintf(want+w, "router#");
+		int n = t.reply(got, 65535);
+		got[n] = 0;
+		char what[64];
+		snprintf(what, sizeof(what), "pager: 20 pages answered, erase %d", e);
+		check_int(t.spaces, 20, what);
+		snprintf(what, sizeof(what), "pager: prompts cut out, erase %d", e);
+		check(n==w && memcmp(got, want, w)==0, what);
+		check(t.found(), "pager: prompt found after the last page");
+	}
+	free(want);
+	free(got);
+}
+
+//rotated by size, files named after their start time, with an index each
+static int size_of(const char *fn)
+{
+	FILE *fp = fopen(fn, "rb");
+	if ( fp==NULL ) return -1;
+	fseek(fp, 0, SEEK_END);
+	int n = ftell(fp);
+	fclose(fp);
+	return n;
+}
+static bool index_ok(const char *fn)	//first entry at offset 0
+{
+	char idx[300];
+	long long ms, pos = -1;
+	snprintf(idx, sizeof(idx), "%s.idx", fn);
+	FILE *fp = fopen(idx, "r");
+	if ( fp==NULL ) return false;
+	bool ok = fscanf(fp, "%lld %lld", &ms, &pos)==2 && pos==0;
+	fclose(fp);
+	remove(idx);
+	return ok;
+}
+static void check_log()
+{
+	const char *name = "termcheck.log";
+	time_t start = time(NULL);
+	Fl_Term_Log log;
+	log.rotate(1000, 0, false);
+	check(log.open(name), "log: opened");
+	char line[64];
+	int total = 0;
+	for ( int i=0; i<100; i++ ) {
+		int n = sprintf(line, "line %03d of the session log\n", i);
+		log.write(line, n);
+		total += n;
+	}
+	log.close();
+	check_int(log.lost(), 0, "log: nothing dropped");
+
+	int files = 1, bytes = size_of(name), ok = index_ok(name);
+	remove(name);
+	for ( time_t s=start-1; s<=time(NULL); s++ ) {
+		char stamp[32], fn[300];
+		struct tm tm;
+#ifdef WIN32
+		localtime_s(&tm, &s);
+#else
+		localtime_r(&s, &tm);
+#endif
+		strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+		for ( int i=0; ; i++ ) {
+			int l = snprintf(fn, sizeof(fn), "%s.%s", name, stamp);
+			if ( i>0 ) snprintf(fn+l, sizeof(fn)-l, "-%d", i);
+			if ( access(fn, 0)!=0 ) break;
+			files++;
+			bytes += size_of(fn);
+			if ( !index_ok(fn) ) ok = false;
+			remove(fn);
+		}
+	}
+	check_int(files, 3, "log: rotated twice at 1000 bytes");
+	check_int(bytes, total, "log: every byte in one of the files");
+	check(ok, "log: an index for each file");
+}
+
+int main(int argc, char **argv)
+{
+	verbose = argc>1 && strcmp(argv[1], "-v")==0;
+	check_text();
+	check_sgr();
+	check_cursor();
+	check_scroll();
+	check_attr();
+	check_ring();
+	check_freeze();
+	check_expect();
+	check_pager();
+	check_log();
+	printf("%d checks, %d failed\n", checks, failed);
+	return failed>0 ? 1 : 0;
+}
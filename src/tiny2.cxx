@@ -18,6 +18,9 @@
 
 // This source code is not for MSVC -
 #include <unistd.h>
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
 
 #include <cstdio>
 #include <cstdlib>
@@ -71,6 +74,7 @@
 #define DEFAULTFONTSIZE	    12
 #define DEFAULTROWS			25
 #define DEFAULTCOLUMNS		80
+#define DEFAULTSCROLLBACK	65536
 
 #ifndef _MAX_PATH
 	#define _MAX_PATH		512
@@ -104,6 +108,13 @@ static char fontname[256] = DEFAULTFONT;
 static int fontsize = DEFAULTFONTSIZE;
 static int termcols = DEFAULTCOLUMNS;
 static int termrows = DEFAULTROWS;
+static int scrollback = DEFAULTSCROLLBACK;
+static int throttle = 0;
+static int logsync = 0;
+static int logstamp = 0;
+static int logsize = 0;
+static int logtime = 0;
+static int loggzip = 0;
 static bool sendtoall = false;
 static bool local_edit = false;
 static double opacity = 1.0;
@@ -178,6 +189,7 @@ void term_cb(Fl_Widget *w, void *data ) //called when term connection changes
     Fl_Term *term=(Fl_Term *)w;
     if ( term==pTerm ) {
         title_changed = true;
+        Fl::awake();    //for redraw_cb to pick it up
     }
     if ( data==NULL ) {//disconnected
         if ( pCmd->visible() ) term->disp(FLTERM);
@@ -238,7 +250,8 @@ void tab_cb(Fl_Widget *w)
     pTabs->redraw(); 
 }
 
-void tab_new()
+// act is false for tabs opened by scripts in the background
+Fl_Term *tab_new(bool act=true)
 {
     if ( pTabs==NULL ) 
 	{
@@ -259,10 +272,23 @@ void tab_new()
     Fl_Term *pt = new Fl_Term(0, 0, 800, 480, "term");
     pt->labelsize(fontsize);
     pt->textsize(fontsize);
+    pt->scrollback(scrollback);
+    pt->throttle(throttle);
+    pt->logg_sync(logsync);
+    pt->logg_stamp(logstamp!=0);
+    pt->logg_rotate(logsize, logtime, loggzip!=0);
     pt->callback(term_cb);
     pTabs->add(pt);
-    tab_act(pt);
+    if ( act ) 
+        tab_act(pt);
+    else 
+    {
+        pt->textfont(fontnum);
+        pt->hide();
+        pTabs->redraw();
+    }
     pt->resize(0, MENUHEIGHT+TABHEIGHT, pTabs->w(), pTabs->h()-TABHEIGHT);
+    return pt;
 }
 
 HOST *host_new(const char *hostname)
@@ -306,7 +332,7 @@ HOST *host_new(const char *hostname)
 
 void term_connect(const char *hostname)
 {
-    if ( pTerm->live() ) 
+    if ( pTerm->live() || pTerm->replaying()>=0 ) 
 		tab_new();
 
     HOST *host=host_new(hostname);
@@ -333,14 +359,44 @@ bool tab_match(int i, char *label)
     return false;
 }
 
-int term_command(char *cmd, const char **preply)
+// tab by position from 0, or by the start of its label, NULL if none
+Fl_Term *tab_find(const char *id)
+{
+    if ( pTabs==NULL ) 
+        return strcmp(id, "0")==0 || 
+               strncmp(pTerm->label(), id, strlen(id))==0 ? pTerm : NULL;
+
+    if ( *id>='0' && *id<='9' ) 
+    {
+        int i = atoi(id);
+        return i<pTabs->children() ? (Fl_Term *)pTabs->child(i) : NULL;
+    }
+
+    for ( int i=0; i<pTabs->children(); i++ ) 
+    {
+        Fl_Term *t = (Fl_Term *)pTabs->child(i);
+        if ( strncmp(t->label(), id, strlen(id))==0 ) return t;
+    }
+    return NULL;
+}
+
+// runs on HTTPd workers, each client keeps the tab it last picked with !Tab,
+// so clients on different tabs run their commands in parallel
+int term_command(char *cmd, const char **preply, Fl_Term_Pin *pin, 
+                 Fl_Term **pterm)
 {
     int rc = 0;
+    Fl::lock();
+    Fl_Term *term = *pterm;
+    if ( term==NULL || 
+        (pTabs==NULL ? term!=pTerm : pTabs->find(term)==pTabs->children()) )
+        term = pTerm;   //not picked yet, or the tab was closed
+
     if ( strncmp(cmd, "!Tab", 4)==0 ) 
 	{
         if ( cmd[4]==' ' && pTabs!=NULL ) 
 		{
-            int i, c = pTabs->find(pTerm);
+            int i, c = pTabs->find(term);
 
             for ( i=c+1; i<pTabs->children(); i++ ) 
 			{   //search forward
@@ -356,21 +412,76 @@ int term_command(char *cmd, const char **preply)
         else
             tab_new();
 
+        term = pTerm;
         if ( preply!=NULL ) 
-		{
-            *preply = pTerm->label();
+		{   //the label is freed when the tab is renamed or closed
+            *preply = term->label();
             rc = strlen(*preply);
+            if ( pin!=NULL ) 
+            {
+                term_pin_own(pin, strdup(*preply), rc);
+                *preply = "";
+            }
         }
+        *pterm = term;
+        Fl::unlock();
+        Fl::awake();
     }
     else 
 	{
-        rc = pTerm->command(cmd, preply);
-    
+        *pterm = term;
+        Fl::unlock();
+        rc = term->command(cmd, preply, pin);
 	}
 
     return rc;
 }
 
+// /tabs lists the tabs, /tab/new opens one in the background, and 
+// /tab/<id>/cmd?<command> runs a command on a tab without activating it,
+// returns -1 if there is no such tab
+int tab_command(char *cmd, const char **preply, Fl_Term_Pin *pin, 
+                char *buf, int size)
+{
+    Fl::lock();
+    if ( strcmp(cmd, "tabs")==0 ) 
+    {   //"<id> <label>" on each line
+        int len = 0;
+        int cnt = pTabs==NULL ? 1 : pTabs->children();
+        for ( int i=0; i<cnt && len<size; i++ ) 
+        {
+            Fl_Term *t = pTabs==NULL ? pTerm : (Fl_Term *)pTabs->child(i);
+            const char *label = t->label();
+            const char *x = strstr(label, " @-31+");
+            int l = x!=NULL ? x-label : strlen(label);
+            len += snprintf(buf+len, size-len, "%d %.*s\n", i, l, label);
+        }
+        Fl::unlock();
+        *preply = buf;
+        return len<size ? len : size-1;
+    }
+    if ( strcmp(cmd, "tab/new")==0 ) 
+    {
+        Fl_Term *t = tab_new(false);
+        int len = snprintf(buf, size, "%d", pTabs->find(t));
+        Fl::unlock();
+        Fl::awake();
+        *preply = buf;
+        return len;
+    }
+
+    Fl_Term *term = NULL;
+    char *p = strchr(cmd+4, '/');
+    if ( p!=NULL && strncmp(p, "/cmd?", 5)==0 ) 
+    {
+        *p = 0;
+        term = tab_find(cmd+4);
+    }
+    Fl::unlock();
+    if ( term==NULL ) return -1;
+    return term->command(p+5, preply, pin);
+}
+
 /*******************************************************************************
 *  connection dialog functions                                                 *
 *******************************************************************************/
@@ -904,7 +1015,10 @@ void menu_cb(Fl_Widget *w, void *data)
         }
         else 
 		{
-            if ( fl_choice("Stop logging to %s?", "No", "Yes", 0, fname)==0 )
+            if ( fl_choice("Stop logging to %s?\n"
+                            "%u bytes waiting to be written, %u dropped", 
+                            "No", "Yes", 0, fname, 
+                            pTerm->logg_lag(), pTerm->logg_lost())==0 )
                  return;
         }
         pTerm->logg(fname);
@@ -913,18 +1027,63 @@ void menu_cb(Fl_Widget *w, void *data)
 	if ( strcmp(menutext, "&Save...")==0 ) 
 	{
         const char *fname = file_chooser("save buffer to file:", 
-                                         "Text\t*.txt", SAVE_FILE);
+                        "Text\t*.txt\nANSI colors\t*.ans\nHTML\t*.html", 
+                        SAVE_FILE);
         if ( fname!=NULL ) pTerm->save(fname);
     }
+    else 
+	if ( strcmp(menutext, "Re&play...")==0 ) 
+	{
+        const char *fname = file_chooser("replay session log:", 
+                                         "Log\t*.log", OPEN_FILE);
+        if ( fname!=NULL ) 
+		{
+            if ( pTerm->live() || pTerm->replaying()>=0 ) 
+                tab_new();
+            pTerm->replay(fname);
+        }
+    }
     else 
 	if ( strcmp(menutext, "Search...")==0 ) 
 	{
-        const char *keyword="";
-        while ( true ) 
+        const char *keyword = fl_input("Search buffer for:", "");
+        if ( keyword!=NULL && *keyword ) 
 		{
-            keyword = fl_input("Search buffer for:", keyword);
-            if ( keyword==NULL ) break;
-            pTerm->srch(keyword);
+            char word[256];
+            strncpy(word, keyword, 255);
+            word[255] = 0;
+            int cnt = pTerm->srch_all(word);    //highlight all matches
+            pTerm->srch(word);
+            if ( cnt==0 ) fl_message("\"%s\" not found", word);
+            while ( cnt>0 ) 
+			{
+                int c = fl_choice("%d matches of \"%s\"", "Close", 
+                                    "Previous", "Next", cnt, word);
+                if ( c==0 ) break;
+                pTerm->srch(word, c==1);
+            }
+            pTerm->srch_all("");
+        }
+    }
+    else 
+	if ( strcmp(menutext, "Regex Search...")==0 ) 
+	{
+        const char *expr = fl_input("Regular expression:", "");
+        if ( expr!=NULL && *expr ) 
+		{
+            char re[256];
+            strncpy(re, expr, 255);
+            re[255] = 0;
+            if ( pTerm->srch_regex(re)<0 )  //matches highlighted as found
+                fl_alert("invalid regular expression %s", re);
+            else while ( true ) 
+			{
+                int c = fl_choice("matches of %s", "Close", 
+                                    "Previous", "Next", re);
+                if ( c==0 ) break;
+                pTerm->srch_next(c==1);
+            }
+            pTerm->srch_all("");
         }
     }
     else 
@@ -959,6 +1118,11 @@ void menu_cb(Fl_Widget *w, void *data)
         opacity =  (opacity==1.0) ? 0.875 : 1.0;
         setTransparency(pWindow, opacity);
     }
+    else 
+	if ( strcmp(menutext, "Statistics")==0 ) 
+	{   //overlay of the current tab only
+        pTerm->stats_overlay(!pTerm->stats_overlay());
+    }
 }
 
 void close_cb(Fl_Widget *w, void *data)
@@ -1005,7 +1169,9 @@ Fl_Menu_Item menubar[] = {
 	{"&Connect...", FL_CMD+'c', connect_dlg},
 	{"&Log...",         0,      menu_cb},
 	{"&Save...",        0,      menu_cb},
+	{"Re&play...",      0,      menu_cb},
 	{"Search...",       0,      menu_cb},
+	{"Regex Search...", 0,      menu_cb},
 	{"&Disconnect", FL_CMD+'d', menu_cb,0,  FL_MENU_DIVIDER},
 	{0},
 	{"Script",      FL_CMD+'s', 0,      0,  FL_SUBMENU},
@@ -1016,6 +1182,7 @@ Fl_Menu_Item menubar[] = {
 	{"Local &Edit", FL_CMD+'e', menu_cb,0,  FL_MENU_TOGGLE},
 	{"Send to All",     0,      menu_cb,0,  FL_MENU_TOGGLE},
 	{"Transparency",    0,      menu_cb,0,  FL_MENU_TOGGLE},
+	{"Statistics",      0,      menu_cb},
 #ifndef __APPLE__
 	{"&About FLTerm",0,         about_cb},
 #endif
@@ -1048,6 +1215,13 @@ void load_dict()
 	cfg.get( "FontSize", fontsize, DEFAULTFONTSIZE );
 	cfg.get( "TermSize.Columm", termcols, DEFAULTCOLUMNS );
 	cfg.get( "TermSize.Row", termrows, DEFAULTROWS );
+	cfg.get( "Scrollback", scrollback, DEFAULTSCROLLBACK );
+	cfg.get( "Throttle", throttle, 0 );	//bytes/s, 0 for no limit
+	cfg.get( "LogSync", logsync, 0 );	//seconds between fsync, 0 for never
+	cfg.get( "LogStamp", logstamp, 0 );	//prefix lines with local time
+	cfg.get( "LogRotate.Size", logsize, 0 );	//bytes per file, 0 for no limit
+	cfg.get( "LogRotate.Time", logtime, 0 );	//seconds per file
+	cfg.get( "LogRotate.Gzip", loggzip, 0 );	//compress rotated files
 	cfg.get( "WindowOpacity", opacity, 1.f );
 
 	if ( pWindow != nullptr )
@@ -1148,6 +1322,13 @@ void save_dict()
 	cfg.set( "FontSize", fontsize );
 	cfg.set( "TermSize.Columm" , termcols );
 	cfg.set( "TermSize.Row", termrows );
+	cfg.set( "Scrollback", scrollback );
+	cfg.set( "Throttle", throttle );
+	cfg.set( "LogSync", logsync );
+	cfg.set( "LogStamp", logstamp );
+	cfg.set( "LogRotate.Size", logsize );
+	cfg.set( "LogRotate.Time", logtime );
+	cfg.set( "LogRotate.Gzip", loggzip );
 	cfg.set( "WindowOpacity", opacity );
 
 	if ( pWindow != nullptr )
@@ -1272,15 +1453,36 @@ void save_dict()
 }
 #endif /// of 1
 
+void frame_cb(void *)
+{
+    //nothing to do, waking up the event loop runs redraw_cb again
+}
+
+static bool title_busy()    //progress in the title or a script dialog to show
+{
+    int pct = pTerm->replaying();
+    return pTerm->saving()>=0 || (pct>=0 && pct<100) || 
+           pTerm->script_running()!=(pScriptDlg->visible()!=0);
+}
+void title_cb(void *);
+
+// check callback, runs only when the event loop wakes up, which
+// Fl_Term::append() does with Fl::awake() once until next draw
 void redraw_cb(void *)
 {
+    if ( (title_changed || title_busy()) && !Fl::has_timeout(title_cb) )
+        Fl::add_timeout(title_changed ? 0.0 : 1.0, title_cb);
     if ( pTerm->pending() ) 
 	{
-        pTerm->redraw();
+        double wait = pTerm->frame_wait();  //50 frames/s at most, 10 if flooded
+        if ( wait>0.001 ) 
+        {
+            if ( !Fl::has_timeout(frame_cb) ) Fl::add_timeout(wait, frame_cb);
+            return;
+        }
+        pTerm->damage(FL_DAMAGE_USER1); //draws only rows that changed
         if ( pCmd->visible() ) pCmd->redraw();
     }
-
-    Fl::repeat_timeout(0.02, redraw_cb);
 }
 
 static char title[256]="FLTermEx     ";
@@ -1299,12 +1501,32 @@ void title_cb(void *)
         }
     }
 
+    int pct = pTerm->saving();
+    if ( pct>=0 ) 
+	{   //title is put back once saving is done
+        snprintf(title+12, 240, "saving %d%%", pct);
+        pWindow->label(title);
+        title_changed = true;
+    }
+    else 
+    {   //how far a replayed log has been parsed
+        pct = pTerm->replaying();
+        if ( pct>=0 ) 
+        {
+            snprintf(title+12, 240, "%s %d%%", pTerm->title(), pct);
+            pWindow->label(title);
+        }
+    }
+
     if ( pTerm->script_running() )
         pScriptDlg->show();
     else 
         pScriptDlg->hide();
 
-    Fl::repeat_timeout(1.0, title_cb);
+    //only ticks while saving, replaying or running a script, redraw_cb
+    //arms it again when one starts, so an idle terminal never wakes up
+    if ( title_busy() || pTerm->script_running() ) 
+        Fl::repeat_timeout(1.0, title_cb);
 }
 
 int main(int argc, char **argv)
@@ -1374,6 +1596,11 @@ int main(int argc, char **argv)
     font_dlg_build();   //get fontnum
     pTerm->textfont(fontnum);
     pTerm->textsize(fontsize);
+    pTerm->scrollback(scrollback);
+    pTerm->throttle(throttle);
+    pTerm->logg_sync(logsync);
+    pTerm->logg_stamp(logstamp!=0);
+    pTerm->logg_rotate(logsize, logtime, loggzip!=0);
     pCmd->textfont(fontnum);
     pCmd->textsize(fontsize);
     resize_window(termcols, termrows);
@@ -1384,7 +1611,7 @@ int main(int argc, char **argv)
     char cwd[4096] = {0};
     fl_getcwd(cwd, 4096);   //save cwd set by load_dict()
 
-    Fl::add_timeout(0.02, redraw_cb);
+    Fl::add_check(redraw_cb);
     Fl::add_timeout(1.0, title_cb);
     if ( !local_edit ) connect_dlg(NULL, NULL);
     about_cb( NULL, NULL );
@@ -1398,10 +1625,17 @@ int main(int argc, char **argv)
 }
 
 /**********************************HTTPd**************************************/
+#define HTTPD_WORKERS   64      //clients served at the same time
+#define HTTPD_IDLE      60      //seconds a kept alive client may be idle
+#define HTTPD_WAIT      1       //seconds idle when other clients are waiting
+
 const char HEADER[]="HTTP/1.1 200 OK\nServer: FLTerm\n\
 Access-Control-Allow-Origin: *\nContent-Type: text/plain\n\
 Cache-Control: no-cache\nContent-length: %d\n\n";
 
+const char NOTAB[]="HTTP/1.1 404 not found\nServer: FLTerm\n\
+Access-Control-Allow-Origin: *\nContent-length: 0\n\n";
+
 const char *RFC1123FMT="%a, %d %b %Y %H:%M:%S GMT";
 const char *exts[]={".txt",
                     ".htm", ".html",
@@ -1418,7 +1652,9 @@ const char *mime[]={"text/plain",
                     "text/css"
                     };
 
-void httpFile(int s1, char *file)
+// a regular file that can be opened, anything else is not found,
+// returns false when the connection should be closed
+bool httpFile(int s1, char *file)
 {
     char reply[4096], timebuf[128];
     time_t now = time(NULL);
@@ -1426,7 +1662,9 @@ void httpFile(int s1, char *file)
 
     int len;
     struct stat sb;
-    if ( stat( file, &sb ) ==-1 ) 
+    FILE *fp = NULL;
+    if ( stat( file, &sb )==-1 || !S_ISREG(sb.st_mode) || 
+        (fp=fopen( file, "rb" ))==NULL ) 
 	{
         int snplen = 4096;
 
@@ -1435,7 +1673,7 @@ void httpFile(int s1, char *file)
 
         if ( snplen > 0 ) 
 		{
-            len+=snprintf(reply+len, snplen,"Server: FLTerm\nConnection: close");
+            len+=snprintf(reply+len, snplen,"Server: FLTerm\nConnection: keep-alive\n");
             snplen -= len;
         }
 
@@ -1451,60 +1689,239 @@ void httpFile(int s1, char *file)
             snplen -= len;
         }
 
-        send(s1, reply, len, 0);
-        return;
+        return send(s1, reply, len, 0)>=0;
     }
 
-    FILE *fp = fopen( file, "rb" );
-    if ( fp!=NULL ) 
+    int snplen = 4096;
+    len=snprintf(reply, snplen, "HTTP/1.1 200 Ok\nDate: %s\n", timebuf);
+    snplen -= len;
+
+    if ( snplen > 0 ) 
 	{
-        int snplen = 4096;
-        len=snprintf(reply, snplen, "HTTP/1.1 200 Ok\nDate: %s\n", timebuf);
+        len+=snprintf(reply+len, snplen, "Server: FLTerm\nConnection: keep-alive\n");
         snplen -= len;
+    }
 
-        if ( snplen > 0 ) 
-		{
-            len+=snprintf(reply+len, snplen, "Server: FLTerm\nConnection: close");
-            snplen -= len;
-        }
+    const char *filext=strrchr(file, '.');
+    int i=0;
 
-        const char *filext=strrchr(file, '.');
-        int i=0;
+    if ( filext!=NULL ) 
+	{
+        for ( int j=0; j<8; j++ )
+            if ( strcmp(filext, exts[j])==0 ) i=j;
+    }
 
-        if ( filext!=NULL ) 
-		{
-            for ( int j=0; j<8; j++ )
-                if ( strcmp(filext, exts[j])==0 ) i=j;
-        }
+    if ( snplen > 0 ) 
+	{
+        len+=snprintf(reply+len, snplen, "Content-Type: %s\n", mime[i]);
+        snplen -= len;
+    }
 
-        if ( snplen > 0 ) 
-		{
-            len+=snprintf(reply+len, snplen, "Content-Type: %s\n", mime[i]);
-            snplen -= len;
-        }
+    long filesize = sb.st_size;
+    if ( snplen > 0 ) 
+	{
+        len+=snprintf(reply+len, snplen, "Content-Length: %ld\n", filesize);
+        snplen -= len;
+    }
+    
+    strftime(timebuf, sizeof(timebuf), RFC1123FMT, gmtime( &sb.st_mtime));
+    if ( snplen >0 ) 
+	{
+        len+=snprintf(reply+len, snplen, "Last-Modified: %s\n\n", timebuf);
+        snplen -= len;
+    }
 
-        long filesize = sb.st_size;
-        if ( snplen > 0 ) 
-		{
-            len+=snprintf(reply+len, snplen, "Content-Length: %ld\n", filesize);
-            snplen -= len;
+    long sent = send(s1, reply, len, 0)<0 ? -1 : 0;
+    while ( sent>=0 && (len=fread(reply, 1, 4096, fp))>0 )
+	{
+        if ( send(s1, reply, len, 0)==-1 ) sent = -1;
+        else sent += len;
+	}
+
+    fclose(fp);
+    return sent==filesize;  //the client can't tell where a short body ends
+}
+
+// text pinned in the scroll buffer goes out straight from its chunks,
+// a batch of pieces per call
+int httpPin(int s1, Fl_Term_Pin *pin)
+{
+    for ( int i=0; i<pin->cnt; )
+    {
+        int n = 0;
+#ifdef _WIN32
+        WSABUF iov[64];
+        for ( ; n<64 && i+n<pin->cnt; n++ )
+        {
+            iov[n].buf = (char *)pin->text[i+n];
+            iov[n].len = pin->len[i+n];
         }
-        
-        strftime(timebuf, sizeof(timebuf), RFC1123FMT, gmtime( &sb.st_mtime));
-        if ( snplen >0 ) 
-		{
-            len+=snprintf(reply+len, snplen, "Last-Modified: %s\n\n", timebuf);
-            snplen -= len;
+        DWORD sent;
+        if ( WSASend(s1, iov, n, &sent, 0, NULL, NULL)!=0 ) return -1;
+        i += n;
+#else
+        struct iovec iov[64];
+        for ( ; n<64 && i+n<pin->cnt; n++ )
+        {
+            iov[n].iov_base = (void *)pin->text[i+n];
+            iov[n].iov_len = pin->len[i+n];
+        }
+        ssize_t sent = writev(s1, iov, n);
+        if ( sent<0 ) return -1;
+        while ( sent>0 )
+        {   //a partial write resumes in the middle of a piece
+            if ( sent>=pin->len[i] )
+            {
+                sent -= pin->len[i++];
+            }
+            else
+            {
+                pin->text[i] += sent;
+                pin->len[i] -= sent;
+                sent = 0;
+            }
         }
+#endif
+    }
+    return 0;
+}
 
-        send(s1, reply, len, 0);
+// request header ends with an empty line, NULL until all of it is in
+char *httpEnd(char *buf)
+{
+    for ( char *p=strchr(buf, '\n'); p!=NULL; p=strchr(p+1, '\n') )
+    {
+        if ( p[1]=='\n' ) return p+2;
+        if ( p[1]=='\r' && p[2]=='\n' ) return p+3;
+    }
+    return NULL;
+}
 
-        while ( (len=fread(reply, 1, 4096, fp))>0 )
-		{
-            if ( send(s1, reply, len, 0)==-1 ) break;
-		}
+// one GET request, returns false when the connection should be closed
+bool httpRequest(int s1, char *req, Fl_Term **pterm)
+{
+    if ( strncmp(req, "GET /",5)!=0 ) return false;//serve only get request
+
+    char *cmd = req+5;
+    char *p = strchr(cmd, ' ');
+    if ( p!=NULL ) *p = 0;
+    for ( char *p=cmd; *p; p++ ) if ( *p=='+' ) *p=' ';
+    fl_decode_uri(cmd);
+
+    bool tab = strcmp(cmd, "tabs")==0 || strncmp(cmd, "tab/", 4)==0;
+    if ( *cmd!='?' && !tab ) 
+    {  //get file
+        return httpFile(s1, cmd);
+    }
 
-        fclose(fp);
+    //CGI request, to the tab of this client or to the one named in the path
+    char head[256], list[4096];
+    const char *reply = "";
+    Fl_Term_Pin pin = { 0, -1 };
+    int replen;
+    if ( tab ) 
+        replen = tab_command(cmd, &reply, &pin, list, sizeof(list));
+    else 
+        replen = term_command(++cmd, &reply, &pin, pterm);
+    if ( replen<0 ) 
+        return send(s1, NOTAB, strlen(NOTAB), 0)>=0;
+    if ( pin.size>=0 ) replen = pin.size; //less if scrolled out
+    int len = snprintf(head, sizeof(head), HEADER, replen);
+    if ( send(s1, head, len, 0)<0 ) 
+    {
+        term_unpin(&pin);
+        return false;
+    }
+    if ( pin.size>=0 ) 
+    {   //scrollback is not copied, chunks stay until unpinned
+        len = httpPin(s1, &pin);
+        term_unpin(&pin);
+        return len==0;
+    }
+    while ( replen>0 ) 
+    {
+        int pkt_l = replen>8192?8192:replen;
+        len = send(s1, reply, pkt_l, 0);
+        if ( len<0 ) return false;
+        reply+=len;
+        replen-=len;
+    }
+    return true;
+}
+
+bool http_waiting();
+
+// a client is served until it closes the connection or stays idle for
+// HTTPD_IDLE seconds, or for HTTPD_WAIT between requests while accepted
+// clients wait for a worker, requests may come in pieces or back to back
+void httpServe(int s1)
+{
+    Fl_Term *term = NULL;   //tab of this client, the active one at first
+    char buf[4096], req[4096];
+    int got = 0, idle = 0;
+    while ( true ) 
+    {
+        buf[got] = 0;
+        char *end = httpEnd(buf);
+        if ( end==NULL ) 
+        {
+            if ( got==4095 ) break;    //header too long
+            fd_set rfd;
+            FD_ZERO(&rfd);
+            FD_SET(s1, &rfd);
+            struct timeval tv = { HTTPD_WAIT, 0 };
+            int rc = select(s1+1, &rfd, NULL, NULL, &tv);
+            if ( rc<0 ) break;
+            if ( rc==0 ) 
+            {
+                idle += HTTPD_WAIT;
+                if ( idle>=HTTPD_IDLE || (got==0 && http_waiting()) ) break;
+                continue;
+            }
+            idle = 0;
+            int n = recv(s1, buf+got, 4095-got, 0);
+            if ( n<=0 ) break;
+            got += n;
+            continue;
+        }
+        int len = end-buf;
+        memcpy(req, buf, len);
+        req[len] = 0;
+        got -= len;
+        memmove(buf, end, got);
+        if ( !httpRequest(s1, req, &term) ) break;
+    }
+    closesocket(s1);
+}
+
+// clients accepted but not served yet, and the pool serving them, which
+// grows while every worker is busy, up to HTTPD_WORKERS
+static std::mutex http_mtx;
+static std::condition_variable http_cv;
+static int http_queue[HTTPD_WORKERS];
+static int http_head = 0, http_tail = 0;
+static int http_workers = 0, http_idle = 0;
+static bool http_stop = false;
+
+bool http_waiting()
+{
+    std::lock_guard<std::mutex> lck(http_mtx);
+    return http_head!=http_tail;
+}
+
+void httpWorker()
+{
+    std::unique_lock<std::mutex> lck(http_mtx);
+    while ( true ) 
+    {
+        http_idle++;
+        http_cv.wait(lck, []{ return http_head!=http_tail || http_stop; });
+        http_idle--;
+        if ( http_stop ) break;
+        int s1 = http_queue[http_tail++%HTTPD_WORKERS];
+        lck.unlock();
+        httpServe(s1);
+        lck.lock();
     }
 }
 
@@ -1512,46 +1929,24 @@ void httpd( int s0 )
 {
     struct sockaddr_in cltaddr;
     socklen_t addrsize=sizeof(cltaddr);
-    char buf[4096], *cmd;
-    char* bufp = buf;
-    const char *reply;
-    int cmdlen, replen, http_s1;
+    int http_s1;
 
     while ( (http_s1=accept(s0,(struct sockaddr*)&cltaddr,&addrsize ))!=-1 ) 
 	{
-        while ( (cmdlen=recv(http_s1,buf,4095,0))>0 ) 
-		{
-            buf[cmdlen] = 0;
-            if ( strncmp(buf, "GET /",5)!=0 ) break;//serve only get request
-
-            cmd = buf+5;
-            char *p = strchr(cmd, ' ');
-            if ( p!=NULL ) *p = 0;
-            for ( char *p=cmd; *p; p++ ) if ( *p=='+' ) *p=' ';
-            fl_decode_uri(cmd);
-
-            if ( *cmd!='?' ) 
-			{  //get file
-                httpFile(http_s1, cmd);
-            }
-            else 
-			{   //CGI request
-                replen = term_command(++cmd, &reply);
-                int snplen = 4096 - ( buf - bufp );
-                int len = snprintf(buf, snplen, HEADER, replen);
-                if ( send(http_s1, buf, len, 0)<0 ) break;
-                len = 0;
-                while ( replen>0 ) {
-                    int pkt_l = replen>8192?8192:replen;
-                    len = send(http_s1, reply+len, pkt_l, 0);
-                    if ( len<0 ) break;
-                    reply+=len;
-                    replen-=len;
-                }
-                if ( len<0 ) break;
-            }   
+        std::lock_guard<std::mutex> lck(http_mtx);
+        if ( http_head-http_tail==HTTPD_WORKERS ) 
+        {   //too many waiting already
+            closesocket(http_s1);
+            continue;
+        }
+        http_queue[http_head++%HTTPD_WORKERS] = http_s1;
+        if ( http_head-http_tail>http_idle && http_workers<HTTPD_WORKERS ) 
+        {
+            http_workers++;
+            std::thread worker(httpWorker);
+            worker.detach();
         }
-        closesocket(http_s1);
+        http_cv.notify_one();
     }
 }
 
@@ -1582,7 +1977,7 @@ void httpd_init()
 
     if ( port<8100) 
 	{
-        if ( listen(http_s0, 1)!=-1){
+        if ( listen(http_s0, HTTPD_WORKERS)!=-1){
             std::thread httpThread(httpd, http_s0);
             httpThread.detach();
             httport = port;
@@ -1594,4 +1989,7 @@ void httpd_init()
 void httpd_exit()
 {
     closesocket(http_s0);
+    std::lock_guard<std::mutex> lck(http_mtx);
+    http_stop = true;       //idle workers leave before exit
+    http_cv.notify_all();
 }